@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "BatchExpr.h"
+#include "MatrixKernels.h"
+
+
+std::unique_ptr<BatchExpr> BatchExpr::compile(const Func *f, size_t ivar, const std::vector<Value> &args) {
+    std::unique_ptr<Item> root = build(f->body.get(), f, ivar, args);
+    if (!root) {
+        return nullptr;
+    }
+    std::unique_ptr<BatchExpr> res(new BatchExpr());
+    res->root = std::move(root);
+    return res;
+}
+
+bool BatchExpr::eval(const double *xs, double *ys, size_t n) const {
+    return run(root.get(), xs, n, ys);
+}
+
+// Поддерево без аргумента сворачивается в число теми же операциями над double,
+// что выполняет Node::exec, поэтому результат совпадает до бита
+std::unique_ptr<BatchExpr::Item> BatchExpr::build(const Node *n, const Func *f, size_t ivar,
+                                                  const std::vector<Value> &args) {
+    std::unique_ptr<Item> res(new Item());
+    switch (n->_tag) {
+        case NUMBER:
+            res->op = CONSTANT;
+            res->value = std::stod(n->_label);
+            return res;
+        case DIMENSION:
+            res->op = CONSTANT;
+            res->value = 1.0;
+            return res;
+        case IDENT: {
+            if (!n->fields.empty()) return nullptr;
+            if (n->_slot >= 0) {
+                if ((size_t) n->_slot == ivar) {
+                    res->op = ARG;
+                    return res;
+                }
+                if (args[n->_slot].type() != Value::DOUBLE) return nullptr;
+                res->op = CONSTANT;
+                res->value = args[n->_slot].get_double();
+                return res;
+            }
+            auto it = f->local.find(n->_label);
+            if (it == f->local.end()) {
+                it = Node::global.find(n->_label);
+                if (it == Node::global.end()) return nullptr;
+            }
+            if (it->second.type() != Value::DOUBLE) return nullptr;
+            res->op = CONSTANT;
+            res->value = it->second.get_double();
+            return res;
+        }
+        case KEYWORD: {
+            auto c = constants.find(n->_label);
+            if (c != constants.end()) {
+                if (!n->fields.empty()) return nullptr;
+                res->op = CONSTANT;
+                res->value = c->second;
+                return res;
+            }
+            auto fn = funcs1.find(n->_label);
+            if (fn == funcs1.end() || n->fields.size() != 1) return nullptr;
+            res->op = APPLY;
+            res->fn = fn->second;
+            res->a = build(n->fields[0], f, ivar, args);
+            break;
+        }
+        case UADD:
+        case LPAREN:
+            return build(n->right, f, ivar, args);
+        case USUB:
+            res->op = NEGATE;
+            res->a = build(n->right, f, ivar, args);
+            break;
+        case ABS:
+            res->op = MODULUS;
+            res->a = build(n->right, f, ivar, args);
+            break;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case FRAC:
+        case POW:
+            res->op = (n->_tag == ADD) ? PLUS : (n->_tag == SUB) ? MINUS : (n->_tag == MUL) ? TIMES :
+                      (n->_tag == POW) ? POWER : DIVIDE;
+            res->a = build(n->left, f, ivar, args);
+            res->b = build(n->right, f, ivar, args);
+            if (!res->b) return nullptr;
+            if (res->op == POWER) {   //от показателя зависит размерность, поэтому он должен быть постоянным
+                if (res->b->op != CONSTANT) return nullptr;
+                res->value = res->b->value;
+                res->b.reset();
+            }
+            break;
+        default:
+            return nullptr;
+    }
+    if (!res->a) return nullptr;
+
+    //свертка постоянных
+    bool a_const = res->a->op == CONSTANT;
+    bool b_const = !res->b || res->b->op == CONSTANT;
+    if (!a_const || !b_const) {
+        return res;
+    }
+    double x = res->a->value;
+    double y = res->b ? res->b->value : 0.0;
+    switch (res->op) {
+        case PLUS: return constant(x + y);
+        case MINUS: return constant(x - y);
+        case TIMES: return constant(x * y);
+        case DIVIDE:
+            if (y == 0.0) return nullptr;   //ошибку сообщит обычное вычисление
+            return constant(x / y);
+        case NEGATE: return constant(-x);
+        case POWER: return constant(std::pow(x, res->value));
+        case MODULUS: return constant(std::abs(x));
+        case APPLY: return constant(res->fn(x));
+        default: return res;
+    }
+}
+
+std::unique_ptr<BatchExpr::Item> BatchExpr::constant(double v) {
+    std::unique_ptr<Item> res(new Item());
+    res->op = CONSTANT;
+    res->value = v;
+    return res;
+}
+
+bool BatchExpr::run(const Item *item, const double *xs, size_t n, double *out) {
+    switch (item->op) {
+        case CONSTANT:
+            std::fill(out, out + n, item->value);
+            return true;
+        case ARG:
+            std::copy(xs, xs + n, out);
+            return true;
+        default:
+            break;
+    }
+    if (!run(item->a.get(), xs, n, out)) return false;
+    switch (item->op) {
+        case NEGATE:
+            vec_scale(n, -1.0, out, out);
+            return true;
+        case MODULUS:
+            for (size_t k = 0; k < n; ++k) out[k] = std::abs(out[k]);
+            return true;
+        case POWER:
+            for (size_t k = 0; k < n; ++k) out[k] = std::pow(out[k], item->value);
+            return true;
+        case APPLY:
+            for (size_t k = 0; k < n; ++k) out[k] = item->fn(out[k]);
+            return true;
+        default:
+            break;
+    }
+    std::vector<double> tmp(n);
+    if (!run(item->b.get(), xs, n, tmp.data())) return false;
+    switch (item->op) {
+        case PLUS:
+            vec_add(n, out, tmp.data(), out);
+            break;
+        case MINUS:
+            vec_sub(n, out, tmp.data(), out);
+            break;
+        case TIMES:
+            vec_mul(n, out, tmp.data(), out);
+            break;
+        case DIVIDE:
+            for (size_t k = 0; k < n; ++k) {
+                if (tmp[k] == 0.0) return false;
+            }
+            vec_div(n, out, tmp.data(), out);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Value.h"
+
+
+// Тело функции, которое можно вычислять сразу на массиве значений одного аргумента:
+// арифметика (+, -, \cdot, /, \frac, ^ с постоянным показателем, \abs) и функции из funcs1
+// над этим аргументом и числами. Остальные аргументы, захваченные и глобальные имена
+// подставляются как постоянные. Размерности от значения аргумента не зависят, поэтому их
+// проверку достаточно выполнить одним обычным вызовом; деление на ноль обнаруживается в eval
+class BatchExpr {
+public:
+    // nullptr, если тело f не такое выражение или аргументы не числа
+    static std::unique_ptr<BatchExpr> compile(const Func *f, size_t ivar, const std::vector<Value> &args);
+
+    // ys[k] = f(xs[k]); false, если в какой-то точке было деление на ноль
+    bool eval(const double *xs, double *ys, size_t n) const;
+
+private:
+    typedef enum Op {
+        CONSTANT, ARG, PLUS, MINUS, TIMES, DIVIDE, NEGATE, POWER, MODULUS, APPLY
+    } Op;
+
+    typedef struct Item {
+        Op op;
+        double value = 0.0;             //CONSTANT: значение, POWER: показатель
+        double (*fn)(double) = nullptr; //APPLY
+        std::unique_ptr<Item> a, b;
+    } Item;
+
+    static std::unique_ptr<Item> build(const Node *n, const Func *f, size_t ivar, const std::vector<Value> &args);
+
+    static std::unique_ptr<Item> constant(double v);
+
+    static bool run(const Item *item, const double *xs, size_t n, double *out);
+
+    std::unique_ptr<Item> root;
+};
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <exception>
+#include <cstdint>
+
+#include "CallFrame.h"
+
+#if __has_include(<ucontext.h>)
+#include <ucontext.h>
+#endif
+
+
+Value *SlotStack::push(size_t n) {
+    if (n == 0) {
+        return nullptr;
+    }
+    for (;;) {
+        if (active == chunks.size()) {
+            Chunk c;
+            c.capacity = std::max(n, chunk_size);
+            c.values.reset(new Value[c.capacity]);
+            chunks.push_back(std::move(c));
+        }
+        Chunk &c = chunks[active];
+        if (c.capacity - c.used >= n) {
+            Value *res = &c.values[c.used];
+            c.used += n;
+            return res;
+        }
+        if (c.used == 0) {  //пустой блок меньше запроса - заменить его большим
+            c.capacity = n;
+            c.values.reset(new Value[c.capacity]);
+            continue;
+        }
+        ++active;
+    }
+}
+
+void SlotStack::pop(Value *slots, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        slots[i] = Value(); //освободить матрицы и функции, лежавшие в слотах
+    }
+    Chunk &c = chunks[active];
+    c.used -= n;
+    if (c.used == 0 && active > 0) {
+        --active;
+    }
+}
+
+SlotStack &SlotStack::local() {
+    static thread_local SlotStack stack;
+    return stack;
+}
+
+
+Frame::Frame(const Func *f, std::vector<Value> &args) : func(f) {
+    size_t n = f->argv.size();
+    slots = SlotStack::local().push(n);
+    for (size_t i = 0; i < n; ++i) {
+        slots[i] = std::move(args[i]);
+    }
+}
+
+Frame::~Frame() {
+    SlotStack::local().pop(slots, func->argv.size());
+}
+
+// Поиск по имени без учета global: аргументы, локальные имена, сама функция, затем замыкание
+const Value *Frame::find(const std::string &name) const {
+    size_t n = func->argv.size();
+    for (size_t i = 0; i < n; ++i) {
+        if (func->argv[i] == name) {
+            return &slots[i];
+        }
+    }
+    auto res = locals.find(name);
+    if (res != locals.end()) {
+        return &res->second;
+    }
+    if (name == func->name) {
+        return &self();
+    }
+    auto cap = func->local.find(name);
+    if (cap != func->local.end()) {
+        return &cap->second;
+    }
+    return nullptr;
+}
+
+Value &Frame::self() const {
+    if (_self.type() != Value::FUNCTION) {
+        auto *f = const_cast<Func *>(func);    //Func неизменяем; меняется только счетчик ссылок
+        f->refs.fetch_add(1, std::memory_order_relaxed);
+        _self = Value(f);
+    }
+    return _self;
+}
+
+
+size_t CallStack::max_depth = 100000;
+
+thread_local size_t CallStack::depth = 0;
+
+CallStack::CallStack(const Coordinate &pos) {
+    if (depth >= max_depth) {
+        throw Error(pos, "Maximum recursion depth exceeded");
+    }
+    ++depth;
+}
+
+CallStack::~CallStack() {
+    --depth;
+}
+
+#if __has_include(<ucontext.h>)
+
+static const size_t segment_size = 8u << 20;
+static const size_t stack_reserve = 256u << 10;    //запас под вычисления между двумя вызовами
+static const size_t thread_stack_budget = 1u << 20; //сколько стека потока можно занять до переключения
+
+typedef struct Segment {
+    std::unique_ptr<char[]> memory;
+    ucontext_t context;
+} Segment;
+
+typedef struct Job {
+    const std::shared_ptr<const Node> *body;
+    Frame *frame;
+    Value result;
+    std::exception_ptr error;
+    ucontext_t caller;
+} Job;
+
+static thread_local uintptr_t stack_limit = 0;  //ниже этого адреса начинается запас текущего стека
+static thread_local std::vector<std::unique_ptr<Segment>> segments;
+static thread_local size_t segments_used = 0;
+static thread_local Job *current_job = nullptr;
+
+static bool stack_is_low() {
+    char probe;
+    auto sp = reinterpret_cast<uintptr_t>(&probe);
+    if (!stack_limit) {
+        stack_limit = sp - thread_stack_budget;
+    }
+    return sp < stack_limit;
+}
+
+static void run_job() {
+    Job *job = current_job;
+    try {
+        job->result = (*job->body)->exec(job->frame);
+    }
+    catch (...) {   //исключение не может пересечь границу контекста, оно передается вызывающему
+        job->error = std::current_exception();
+    }
+}
+
+Value CallStack::exec(const std::shared_ptr<const Node> &body, Frame *frame) {
+    if (!stack_is_low()) {
+        return body->exec(frame);
+    }
+
+    if (segments_used == segments.size()) {
+        segments.emplace_back(new Segment{std::unique_ptr<char[]>(new char[segment_size]), {}});
+    }
+    Segment &seg = *segments[segments_used++];
+
+    Job job{&body, frame, Value(), nullptr, {}};
+    getcontext(&seg.context);
+    seg.context.uc_stack.ss_sp = seg.memory.get();
+    seg.context.uc_stack.ss_size = segment_size;
+    seg.context.uc_link = &job.caller;  //по завершении run_job управление вернется сюда
+    makecontext(&seg.context, run_job, 0);
+
+    uintptr_t outer_limit = stack_limit;
+    stack_limit = reinterpret_cast<uintptr_t>(seg.memory.get()) + stack_reserve;
+    current_job = &job;
+    swapcontext(&job.caller, &seg.context);
+    stack_limit = outer_limit;
+    --segments_used;
+
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+    return job.result;
+}
+
+#else
+
+Value CallStack::exec(const std::shared_ptr<const Node> &body, Frame *frame) {
+    return body->exec(frame);
+}
+
+#endif
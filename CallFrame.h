@@ -0,0 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Value.h"
+
+
+// Стековый аллокатор слотов для аргументов вызовов. Слоты одного кадра лежат подряд
+// и не перемещаются, пока кадр жив; память блоков переиспользуется следующими вызовами.
+// У каждого потока свой стек, поэтому вызовы из разных потоков друг другу не мешают
+class SlotStack {
+public:
+    Value *push(size_t n);
+
+    void pop(Value *slots, size_t n);
+
+    static SlotStack &local();
+
+private:
+    static constexpr size_t chunk_size = 1024;
+
+    struct Chunk {
+        std::unique_ptr<Value[]> values;
+        size_t capacity = 0;
+        size_t used = 0;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t active = 0;
+};
+
+
+// Кадр вызова пользовательской функции: аргументы в слотах (по одному на имя из argv),
+// имена, объявленные во время выполнения тела, и ссылка на замыкание. Имя функции в ее теле
+// обозначает ее саму, поэтому рекурсивный вызов не зависит от того, что под этим именем лежит в global.
+// Func при вызове не изменяется, поэтому одну функцию можно вызывать рекурсивно
+// и из нескольких потоков одновременно
+typedef struct Frame {
+    const Func *func;
+    Value *slots;
+    name_table locals;
+
+    Frame(const Func *f, std::vector<Value> &args);
+
+    Frame(const Frame &) = delete;
+
+    Frame &operator=(const Frame &) = delete;
+
+    ~Frame();
+
+    const Value *find(const std::string &name) const;
+
+    // Значение-функция func (для рекурсивного вызова); создается при первом обращении
+    Value &self() const;
+
+private:
+    mutable Value _self;
+} Frame;
+
+
+// Вложенность вызовов пользовательских функций. Глубина ограничена max_depth, а когда
+// стек потока почти исчерпан, тело функции выполняется на дополнительном сегменте стека
+// из кучи: глубина рекурсии ограничена памятью, а не размером стека потока
+class CallStack {
+public:
+    static size_t max_depth;
+
+    explicit CallStack(const Coordinate &pos);
+
+    CallStack(const CallStack &) = delete;
+
+    CallStack &operator=(const CallStack &) = delete;
+
+    ~CallStack();
+
+    static Value exec(const std::shared_ptr<const Node> &body, Frame *frame);
+
+private:
+    static thread_local size_t depth;
+};
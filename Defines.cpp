@@ -4,6 +4,7 @@
 #include <array>
 
 #include "Defines.h"
+#include "Value.h"
 
 
 Tag_info::Tag_info(
@@ -100,6 +101,7 @@ std::map<Tag, Tag_info> t_info = {
         {GRAPHIC,     Tag_info("GRAPHIC", 0, NONE, NONE)},
         {RANGE,       Tag_info("RANGE", 0, NONE, NONE)},
         {TRANSP,      Tag_info("TRANSP", 0, NONE, NONE)},
+        {SLICE,       Tag_info("SLICE", 0, NONE, NONE)},
 
         {SUM,         Tag_info("SUM", 0, NONE, NONE)},
         {PRODUCT,     Tag_info("PRODUCT", 0, NONE, NONE)},
@@ -152,7 +154,7 @@ std::map<std::string, enum Tag> dim_tag = {
 /**
  * m, kg, s, A, K, mol, cd
  */
-std::map<std::string, std::array<int, 7>> const dimensions = {
+std::map<std::string, Dimension> const dimensions = {
         //метры
         {"m",   {1, 0, 0, 0, 0, 0, 0}},
 
@@ -197,7 +199,13 @@ std::map<std::string, int> arg_count = {
         //  { "\\sec", 1 },
         //  { "\\csc", 1 },
         {"\\floor",  1},
-        {"\\ceil",  1}
+        {"\\ceil",  1},
+        {"\\det",    1},
+        {"\\inv",    1},
+        {"\\solve",  2},
+        {"\\integral", 3},
+        {"\\findroot", 3},
+        {"\\odesolve", 4}
 };
 
 std::map<std::string, double> constants = {
@@ -230,3 +238,15 @@ std::map<std::string, double (*)(double)> funcs1 = {
 };
 
 std::map<std::string, double (*)(double, double)> funcs2 = {};
+
+std::map<std::string, Value (*)(const std::vector<Value> &, const Coordinate &)> funcs_matrix = {
+        {"\\det",   [](const std::vector<Value> &args, const Coordinate &pos) { return Value::det(args[0], pos); }},
+        {"\\inv",   [](const std::vector<Value> &args, const Coordinate &pos) { return Value::inv(args[0], pos); }},
+        {"\\solve", [](const std::vector<Value> &args, const Coordinate &pos) { return Value::solve(args[0], args[1], pos); }}
+};
+
+std::map<std::string, Value (*)(const std::vector<Value> &, const Coordinate &)> funcs_numeric = {
+        {"\\integral", [](const std::vector<Value> &args, const Coordinate &pos) { return Value::integral(args[0], args[1], args[2], pos); }},
+        {"\\findroot", [](const std::vector<Value> &args, const Coordinate &pos) { return Value::findroot(args[0], args[1], args[2], pos); }},
+        {"\\odesolve", [](const std::vector<Value> &args, const Coordinate &pos) { return Value::odesolve(args[0], args[1], args[2], args[3], pos); }}
+};
@@ -7,6 +7,8 @@
 #include <vector>
 #include <array>
 
+#include "Dimension.h"
+
 
 enum Tag {
     NONE = 0,
@@ -21,7 +23,7 @@ enum Tag {
     NUMBER, IDENT, KEYWORD, FUNC,
     ERROR, SPACE,
     PLACEHOLDER, TEXT, LIST, ROOT,
-    GRAPHIC, RANGE, TRANSP, SUM, PRODUCT, DIMENSION, SKIP, ABS, FLOOR, CEIL
+    GRAPHIC, RANGE, TRANSP, SUM, PRODUCT, DIMENSION, SKIP, ABS, FLOOR, CEIL, SLICE
 };
 
 typedef struct Tag_info {
@@ -54,7 +56,7 @@ extern std::map<std::string, enum Tag> dim_tag;
 /**
  * m, kg, s, A, K, mol, cd
  */
-extern std::map<std::string, std::array<int, 7>> const dimensions;
+extern std::map<std::string, Dimension> const dimensions;
 
 extern std::map<std::string, int> arg_count;
 
@@ -63,3 +65,13 @@ extern std::map<std::string, double> constants;
 extern std::map<std::string, double (*)(double)> funcs1;
 
 extern std::map<std::string, double (*)(double, double)> funcs2;
+
+class Value;
+struct Coordinate;
+
+// Функции над матрицами (линейная алгебра): аргументы уже вычислены
+extern std::map<std::string, Value (*)(const std::vector<Value> &, const Coordinate &)> funcs_matrix;
+
+// Численные методы над пользовательской функцией: первый аргумент - функция, последние два - границы
+// (оптимизатор считает каждый такой вызов вызовом функции, см. Node::calls_function)
+extern std::map<std::string, Value (*)(const std::vector<Value> &, const Coordinate &)> funcs_numeric;
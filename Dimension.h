@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+
+
+// Физическая размерность: показатели степеней основных единиц СИ
+// в порядке m, kg, s, A, K, mol, cd. Каждый показатель занимает байт,
+// допустимы степени от -128 до 127.
+// Показатели упакованы в 56-битное слово по байту на показатель (дополнительный код).
+// Сложение и вычитание размерностей - одно сложение или вычитание слов без переноса между байтами,
+// переполнение всех показателей сразу проверяется по знаковым битам, а сравнение - одно сравнение.
+// Старший байт слова свободен (в Value там хранится тег)
+class Dimension {
+public:
+    static const int count = 7;
+
+    static constexpr uint64_t mask = 0x00FFFFFFFFFFFFFFull;
+
+    constexpr Dimension() : _word(0) {}
+
+    constexpr Dimension(int m, int kg, int s, int a, int k, int mol, int cd) :
+    _word(lane(m, 0) | lane(kg, 1) | lane(s, 2) | lane(a, 3) |
+          lane(k, 4) | lane(mol, 5) | lane(cd, 6)) {}
+
+    static constexpr Dimension from_word(uint64_t word) {
+        return Dimension(word & mask, 0);
+    }
+
+    constexpr uint64_t word() const {
+        return _word;
+    }
+
+    int operator[](int i) const {
+        return (int8_t) (_word >> (8 * i));
+    }
+
+    void set(int i, int e) {
+        _word = (_word & ~lane(-1, i)) | lane(e, i);
+    }
+
+    bool is_zero() const {
+        return _word == 0;
+    }
+
+    // Наибольший по модулю показатель: нужен для проверки переполнения при возведении в степень
+    int max_abs() const {
+        int res = 0;
+        for (int i = 0; i < count; ++i) {
+            int e = (*this)[i];
+            if (e < 0) e = -e;
+            if (e > res) res = e;
+        }
+        return res;
+    }
+
+    // Выход показателя за [-128, 127]: в байте он дал бы другой показатель
+    // и незаметно другую единицу
+    class OutOfRange : public std::range_error {
+    public:
+        OutOfRange() : std::range_error("Dimension exponent is out of range") {}
+    };
+
+    // Сумма, разность и кратное с проверкой диапазона каждого показателя: false при выходе за него.
+    // Младшие 7 бит байтов складываются без переноса в соседний байт, старший бит восстанавливается
+    // через xor; знаковое переполнение байта - когда знак результата отличается от знаков обоих слагаемых
+    static bool add(const Dimension &a, const Dimension &b, Dimension &res) {
+        uint64_t r = ((a._word & ~sign_bits) + (b._word & ~sign_bits)) ^ ((a._word ^ b._word) & sign_bits);
+        if ((a._word ^ r) & (b._word ^ r) & sign_bits) return false;
+        res = Dimension(r, 0);
+        return true;
+    }
+
+    // Для вычитания переполнение - когда знаки операндов разные и знак результата отличается от знака a
+    static bool sub(const Dimension &a, const Dimension &b, Dimension &res) {
+        uint64_t r = ((a._word | sign_bits) - (b._word & ~sign_bits)) ^ ((a._word ^ ~b._word) & sign_bits);
+        if ((a._word ^ b._word) & (a._word ^ r) & sign_bits) return false;
+        res = Dimension(r, 0);
+        return true;
+    }
+
+    // Возведение в степень редкое, поэтому по показателям
+    static bool mul(const Dimension &a, int n, Dimension &res) {
+        if (a._word == 0 || n == 1) {
+            res = a;
+            return true;
+        }
+        uint64_t r = 0;
+        for (int i = 0; i < count; ++i) {
+            int64_t e = (int64_t) a[i] * n;
+            if (e < -128 || e > 127) return false;
+            r |= lane((int) e, i);
+        }
+        res = Dimension(r, 0);
+        return true;
+    }
+
+    Dimension operator+(const Dimension &other) const {
+        Dimension res;
+        if (!add(*this, other, res)) throw OutOfRange();
+        return res;
+    }
+
+    Dimension operator-(const Dimension &other) const {
+        Dimension res;
+        if (!sub(*this, other, res)) throw OutOfRange();
+        return res;
+    }
+
+    Dimension operator*(int n) const {
+        Dimension res;
+        if (!mul(*this, n, res)) throw OutOfRange();
+        return res;
+    }
+
+    bool operator==(const Dimension &other) const {
+        return _word == other._word;
+    }
+
+    bool operator!=(const Dimension &other) const {
+        return _word != other._word;
+    }
+
+private:
+    static constexpr uint64_t sign_bits = 0x0080808080808080ull;
+
+    constexpr Dimension(uint64_t word, int) : _word(word) {}
+
+    static constexpr uint64_t lane(int e, int i) {
+        return (uint64_t) (uint8_t) e << (8 * i);
+    }
+
+    uint64_t _word;
+};
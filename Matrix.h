@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+
+// Плотная матрица double. Элементы лежат в общем буфере со счетчиком ссылок,
+// а сама матрица - это окно в буфер: смещение первого элемента, размеры и шаги
+// по строкам и по столбцам. Поэтому срезы строк и столбцов и транспонированная матрица -
+// это матрицы над тем же буфером, без копирования. Запись через неконстантный доступ сначала делает буфер
+// собственным (копирует, если он разделяется с другой матрицей).
+// Физическая размерность у матрицы одна на все элементы и хранится в Value
+class Matrix {
+public:
+    Matrix() = default;
+
+    Matrix(size_t rows, size_t cols, double fill = 0.0) :
+    _buffer(new Buffer(std::vector<double>(rows * cols, fill))), _rows(rows), _cols(cols), _rs(cols) {}
+
+    Matrix(size_t rows, size_t cols, std::vector<double> data) :
+    _buffer(new Buffer(std::move(data))), _rows(rows), _cols(cols), _rs(cols) {}
+
+    Matrix(const Matrix &other) :
+    _buffer(retain(other._buffer)), _offset(other._offset),
+    _rows(other._rows), _cols(other._cols), _rs(other._rs), _cs(other._cs) {}
+
+    Matrix(Matrix &&other) noexcept :
+    _buffer(other._buffer), _offset(other._offset),
+    _rows(other._rows), _cols(other._cols), _rs(other._rs), _cs(other._cs) {
+        other._buffer = nullptr;
+    }
+
+    Matrix &operator=(const Matrix &other) {
+        Matrix tmp(other);
+        swap(tmp);
+        return *this;
+    }
+
+    Matrix &operator=(Matrix &&other) noexcept {
+        Matrix tmp(std::move(other));
+        swap(tmp);
+        return *this;
+    }
+
+    ~Matrix() {
+        release(_buffer);
+    }
+
+    size_t rows() const {
+        return _rows;
+    }
+
+    size_t cols() const {
+        return _cols;
+    }
+
+    size_t size() const {
+        return _rows * _cols;
+    }
+
+    size_t row_stride() const {
+        return _rs;
+    }
+
+    size_t col_stride() const {
+        return _cs;
+    }
+
+    bool same_shape(const Matrix &other) const {
+        return _rows == other._rows && _cols == other._cols;
+    }
+
+    // Элементы идут в буфере подряд, построчно
+    bool contiguous() const {
+        return (_cols <= 1 || _cs == 1) && (_rows <= 1 || _rs == _cols);
+    }
+
+    double operator()(size_t i, size_t j) const {
+        return _buffer->data[_offset + i * _rs + j * _cs];
+    }
+
+    double &operator()(size_t i, size_t j) {
+        make_own();
+        return _buffer->data[_offset + i * _rs + j * _cs];
+    }
+
+    // Первый элемент; остальные доступны через row_stride() и col_stride()
+    const double *data() const {
+        return _buffer ? _buffer->data.data() + _offset : nullptr;
+    }
+
+    // Доступ на запись ко всем элементам подряд: буфер становится собственным и непрерывным
+    double *data() {
+        make_own();
+        return _buffer ? _buffer->data.data() + _offset : nullptr;
+    }
+
+    // Строка i как матрица 1 x cols над тем же буфером
+    Matrix row(size_t i) const {
+        return Matrix(_buffer, _offset + i * _rs, 1, _cols, _rs, _cs);
+    }
+
+    // Столбец j как матрица rows x 1 над тем же буфером
+    Matrix col(size_t j) const {
+        return Matrix(_buffer, _offset + j * _cs, _rows, 1, _rs, _cs);
+    }
+
+    // Транспонированная матрица над тем же буфером: меняются местами размеры и шаги
+    Matrix transposed() const {
+        return Matrix(_buffer, _offset, _cols, _rows, _cs, _rs);
+    }
+
+    void swap(Matrix &other) noexcept {
+        std::swap(_buffer, other._buffer);
+        std::swap(_offset, other._offset);
+        std::swap(_rows, other._rows);
+        std::swap(_cols, other._cols);
+        std::swap(_rs, other._rs);
+        std::swap(_cs, other._cs);
+    }
+
+private:
+    typedef struct Buffer {
+        std::atomic<size_t> refs;
+        std::vector<double> data;
+
+        explicit Buffer(std::vector<double> d) : refs(1), data(std::move(d)) {}
+    } Buffer;
+
+    Matrix(Buffer *buffer, size_t offset, size_t rows, size_t cols, size_t rs, size_t cs) :
+    _buffer(retain(buffer)), _offset(offset), _rows(rows), _cols(cols), _rs(rs), _cs(cs) {}
+
+    static Buffer *retain(Buffer *b) {
+        if (b) b->refs.fetch_add(1, std::memory_order_relaxed);
+        return b;
+    }
+
+    static void release(Buffer *b) {
+        if (b && b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete b;
+        }
+    }
+
+    // Перед записью: если буфер разделяется или окно занимает его не целиком,
+    // элементы окна собираются в новый собственный буфер
+    void make_own() {
+        if (!_buffer || (_buffer->refs.load(std::memory_order_acquire) == 1 && contiguous() &&
+                         _offset == 0 && _buffer->data.size() == size())) {
+            return;
+        }
+        const Matrix &self = *this;
+        std::vector<double> d(size());
+        for (size_t i = 0; i < _rows; ++i) {
+            for (size_t j = 0; j < _cols; ++j) {
+                d[i * _cols + j] = self(i, j);
+            }
+        }
+        release(_buffer);
+        _buffer = new Buffer(std::move(d));
+        _offset = 0;
+        _rs = _cols;
+        _cs = 1;
+    }
+
+    Buffer *_buffer = nullptr;
+    size_t _offset = 0;
+    size_t _rows = 0;
+    size_t _cols = 0;
+    size_t _rs = 0;
+    size_t _cs = 1;
+};
+
@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "MatrixKernels.h"
+#include "ThreadPool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+// Блок регистров: микроядро считает MR x NR элементов C за один проход по k.
+// Блоки кеша: панель A (MC x KC) помещается в L2, панель B (KC x NC) - в L3
+static const size_t MR = 4;
+static const size_t NR = 8;
+static const size_t KC = 256;
+static const size_t MC = 96;
+static const size_t NC = 1024;
+
+// меньше этого числа умножений потоки не окупаются
+static const size_t parallel_threshold = 1u << 21;
+
+typedef void (*MicroKernel)(size_t kc, const double *pa, const double *pb, double *acc);
+
+static void micro_generic(size_t kc, const double *pa, const double *pb, double *acc) {
+    double c[MR][NR] = {};
+    for (size_t p = 0; p < kc; ++p) {
+        for (size_t i = 0; i < MR; ++i) {
+            for (size_t j = 0; j < NR; ++j) {
+                c[i][j] += pa[i] * pb[j];
+            }
+        }
+        pa += MR;
+        pb += NR;
+    }
+    for (size_t i = 0; i < MR; ++i) {
+        for (size_t j = 0; j < NR; ++j) {
+            acc[i * NR + j] = c[i][j];
+        }
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("avx2,fma")))
+static void micro_avx2(size_t kc, const double *pa, const double *pb, double *acc) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    for (size_t p = 0; p < kc; ++p) {
+        __m256d b0 = _mm256_loadu_pd(pb);
+        __m256d b1 = _mm256_loadu_pd(pb + 4);
+        __m256d a = _mm256_broadcast_sd(pa);
+        c00 = _mm256_fmadd_pd(a, b0, c00);
+        c01 = _mm256_fmadd_pd(a, b1, c01);
+        a = _mm256_broadcast_sd(pa + 1);
+        c10 = _mm256_fmadd_pd(a, b0, c10);
+        c11 = _mm256_fmadd_pd(a, b1, c11);
+        a = _mm256_broadcast_sd(pa + 2);
+        c20 = _mm256_fmadd_pd(a, b0, c20);
+        c21 = _mm256_fmadd_pd(a, b1, c21);
+        a = _mm256_broadcast_sd(pa + 3);
+        c30 = _mm256_fmadd_pd(a, b0, c30);
+        c31 = _mm256_fmadd_pd(a, b1, c31);
+        pa += MR;
+        pb += NR;
+    }
+    _mm256_storeu_pd(acc, c00);
+    _mm256_storeu_pd(acc + 4, c01);
+    _mm256_storeu_pd(acc + 8, c10);
+    _mm256_storeu_pd(acc + 12, c11);
+    _mm256_storeu_pd(acc + 16, c20);
+    _mm256_storeu_pd(acc + 20, c21);
+    _mm256_storeu_pd(acc + 24, c30);
+    _mm256_storeu_pd(acc + 28, c31);
+}
+
+#endif
+
+// Ядра выбираются один раз, по возможностям процессора, на котором запущена программа
+static bool has_avx2() {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+static MicroKernel select_kernel() {
+#ifdef HAVE_X86_KERNELS
+    if (has_avx2()) {
+        return micro_avx2;
+    }
+#endif
+    return micro_generic;
+}
+
+static const MicroKernel micro_kernel = select_kernel();
+
+// Панель A mc x kc раскладывается полосами по MR строк, недостающие строки заполняются нулями
+static void pack_a(size_t mc, size_t kc, const double *a, size_t rs, size_t cs, double *dst) {
+    for (size_t i0 = 0; i0 < mc; i0 += MR) {
+        size_t mr = std::min(MR, mc - i0);
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i = 0; i < mr; ++i) {
+                *dst++ = a[(i0 + i) * rs + p * cs];
+            }
+            for (size_t i = mr; i < MR; ++i) {
+                *dst++ = 0.0;
+            }
+        }
+    }
+}
+
+// Панель B kc x nc раскладывается полосами по NR столбцов
+static void pack_b(size_t kc, size_t nc, const double *b, size_t rs, size_t cs, double *dst) {
+    for (size_t j0 = 0; j0 < nc; j0 += NR) {
+        size_t nr = std::min(NR, nc - j0);
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t j = 0; j < nr; ++j) {
+                *dst++ = b[p * rs + (j0 + j) * cs];
+            }
+            for (size_t j = nr; j < NR; ++j) {
+                *dst++ = 0.0;
+            }
+        }
+    }
+}
+
+static void gemm_serial(size_t m, size_t n, size_t k,
+                        const double *a, size_t a_rs, size_t a_cs,
+                        const double *b, size_t b_rs, size_t b_cs,
+                        double *c, size_t c_rs, size_t c_cs) {
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            c[i * c_rs + j * c_cs] = 0.0;
+        }
+    }
+
+    //буферы упаковки переиспользуются между вызовами, у каждого потока свои
+    static thread_local std::vector<double> packed_a;
+    static thread_local std::vector<double> packed_b;
+    packed_a.resize(MC * KC);
+    packed_b.resize(KC * ((std::min(NC, n) + NR - 1) / NR * NR));
+    double acc[MR * NR];
+
+    for (size_t j0 = 0; j0 < n; j0 += NC) {
+        size_t nc = std::min(NC, n - j0);
+        for (size_t p0 = 0; p0 < k; p0 += KC) {
+            size_t kc = std::min(KC, k - p0);
+            pack_b(kc, nc, b + p0 * b_rs + j0 * b_cs, b_rs, b_cs, packed_b.data());
+            for (size_t i0 = 0; i0 < m; i0 += MC) {
+                size_t mc = std::min(MC, m - i0);
+                pack_a(mc, kc, a + i0 * a_rs + p0 * a_cs, a_rs, a_cs, packed_a.data());
+                for (size_t jr = 0; jr < nc; jr += NR) {
+                    size_t nr = std::min(NR, nc - jr);
+                    for (size_t ir = 0; ir < mc; ir += MR) {
+                        size_t mr = std::min(MR, mc - ir);
+                        micro_kernel(kc, packed_a.data() + ir * kc, packed_b.data() + jr * kc, acc);
+                        double *cp = c + (i0 + ir) * c_rs + (j0 + jr) * c_cs;
+                        for (size_t i = 0; i < mr; ++i) {
+                            for (size_t j = 0; j < nr; ++j) {
+                                cp[i * c_rs + j * c_cs] += acc[i * NR + j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Большие произведения делятся по строкам C между потоками пула: полосы не пересекаются,
+// поэтому синхронизация нужна только на завершении. Внутри задачи пула (например, точки \graphic)
+// полосы считаются по очереди в том же потоке
+void gemm(size_t m, size_t n, size_t k,
+          const double *a, size_t a_rs, size_t a_cs,
+          const double *b, size_t b_rs, size_t b_cs,
+          double *c, size_t c_rs, size_t c_cs) {
+    size_t threads = std::min(ThreadPool::threads, (m + MR - 1) / MR);
+    if (threads <= 1 || m * n * k < parallel_threshold) {
+        gemm_serial(m, n, k, a, a_rs, a_cs, b, b_rs, b_cs, c, c_rs, c_cs);
+        return;
+    }
+    size_t rows = ((m + threads - 1) / threads + MR - 1) / MR * MR;
+    size_t parts = (m + rows - 1) / rows;
+    ThreadPool::instance().run(parts, [&](size_t part) {
+        size_t i0 = part * rows;
+        gemm_serial(std::min(rows, m - i0), n, k, a + i0 * a_rs, a_rs, a_cs,
+                    b, b_rs, b_cs, c + i0 * c_rs, c_rs, c_cs);
+    });
+}
+
+
+// Поэлементные операции над непрерывными массивами
+
+typedef void (*BinaryKernel)(size_t n, const double *a, const double *b, double *c);
+typedef void (*ScaleKernel)(size_t n, double k, const double *a, double *c);
+typedef bool (*EqualKernel)(size_t n, const double *a, const double *b);
+
+static void add_generic(size_t n, const double *a, const double *b, double *c) {
+    for (size_t i = 0; i < n; ++i) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+static void sub_generic(size_t n, const double *a, const double *b, double *c) {
+    for (size_t i = 0; i < n; ++i) {
+        c[i] = a[i] - b[i];
+    }
+}
+
+static void mul_generic(size_t n, const double *a, const double *b, double *c) {
+    for (size_t i = 0; i < n; ++i) {
+        c[i] = a[i] * b[i];
+    }
+}
+
+static void div_generic(size_t n, const double *a, const double *b, double *c) {
+    for (size_t i = 0; i < n; ++i) {
+        c[i] = a[i] / b[i];
+    }
+}
+
+static void scale_generic(size_t n, double k, const double *a, double *c) {
+    for (size_t i = 0; i < n; ++i) {
+        c[i] = k * a[i];
+    }
+}
+
+static bool equal_generic(size_t n, const double *a, const double *b) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("avx2,fma")))
+static void add_avx2(size_t n, const double *a, const double *b, double *c) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(c + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; ++i) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void sub_avx2(size_t n, const double *a, const double *b, double *c) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(c + i, _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; ++i) {
+        c[i] = a[i] - b[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void mul_avx2(size_t n, const double *a, const double *b, double *c) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(c + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; ++i) {
+        c[i] = a[i] * b[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void div_avx2(size_t n, const double *a, const double *b, double *c) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(c + i, _mm256_div_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; ++i) {
+        c[i] = a[i] / b[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void scale_avx2(size_t n, double k, const double *a, double *c) {
+    __m256d kv = _mm256_set1_pd(k);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(c + i, _mm256_mul_pd(kv, _mm256_loadu_pd(a + i)));
+    }
+    for (; i < n; ++i) {
+        c[i] = k * a[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static bool equal_avx2(size_t n, const double *a, const double *b) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d ne = _mm256_cmp_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _CMP_NEQ_UQ);
+        if (_mm256_movemask_pd(ne)) return false;
+    }
+    for (; i < n; ++i) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+#endif
+
+static const bool use_avx2 = has_avx2();
+
+#ifdef HAVE_X86_KERNELS
+static const BinaryKernel add_kernel = use_avx2 ? add_avx2 : add_generic;
+static const BinaryKernel sub_kernel = use_avx2 ? sub_avx2 : sub_generic;
+static const BinaryKernel mul_kernel = use_avx2 ? mul_avx2 : mul_generic;
+static const BinaryKernel div_kernel = use_avx2 ? div_avx2 : div_generic;
+static const ScaleKernel scale_kernel = use_avx2 ? scale_avx2 : scale_generic;
+static const EqualKernel equal_kernel = use_avx2 ? equal_avx2 : equal_generic;
+#else
+static const BinaryKernel add_kernel = add_generic;
+static const BinaryKernel sub_kernel = sub_generic;
+static const BinaryKernel mul_kernel = mul_generic;
+static const BinaryKernel div_kernel = div_generic;
+static const ScaleKernel scale_kernel = scale_generic;
+static const EqualKernel equal_kernel = equal_generic;
+#endif
+
+void vec_add(size_t n, const double *a, const double *b, double *c) {
+    add_kernel(n, a, b, c);
+}
+
+void vec_sub(size_t n, const double *a, const double *b, double *c) {
+    sub_kernel(n, a, b, c);
+}
+
+void vec_mul(size_t n, const double *a, const double *b, double *c) {
+    mul_kernel(n, a, b, c);
+}
+
+void vec_div(size_t n, const double *a, const double *b, double *c) {
+    div_kernel(n, a, b, c);
+}
+
+void vec_scale(size_t n, double k, const double *a, double *c) {
+    scale_kernel(n, k, a, c);
+}
+
+bool vec_equal(size_t n, const double *a, const double *b) {
+    return equal_kernel(n, a, b);
+}
+
+
+bool lu_decompose(size_t n, double *a, size_t *piv, int &sign) {
+    sign = 1;
+    for (size_t i = 0; i < n; ++i) {
+        piv[i] = i;
+    }
+    for (size_t k = 0; k < n; ++k) {
+        size_t p = k;
+        double best = std::abs(a[k * n + k]);
+        for (size_t i = k + 1; i < n; ++i) {
+            double v = std::abs(a[i * n + k]);
+            if (v > best) {
+                best = v;
+                p = i;
+            }
+        }
+        if (best == 0.0) {
+            return false;
+        }
+        if (p != k) {
+            std::swap_ranges(a + k * n, a + k * n + n, a + p * n);
+            std::swap(piv[k], piv[p]);
+            sign = -sign;
+        }
+        //вычитание ведущей строки из оставшихся: хвосты строк лежат подряд
+        const double *pivot_row = a + k * n;
+        double inv = 1.0 / pivot_row[k];
+        for (size_t i = k + 1; i < n; ++i) {
+            double *row = a + i * n;
+            double l = row[k] * inv;
+            row[k] = l;
+            for (size_t j = k + 1; j < n; ++j) {
+                row[j] -= l * pivot_row[j];
+            }
+        }
+    }
+    return true;
+}
+
+void lu_solve(size_t n, const double *lu, const size_t *piv, double *b, size_t nrhs) {
+    std::vector<double> x(n * nrhs);
+    for (size_t i = 0; i < n; ++i) {
+        std::copy(b + piv[i] * nrhs, b + piv[i] * nrhs + nrhs, x.begin() + i * nrhs);
+    }
+    //L y = P b
+    for (size_t i = 0; i < n; ++i) {
+        double *xi = x.data() + i * nrhs;
+        for (size_t k = 0; k < i; ++k) {
+            double l = lu[i * n + k];
+            const double *xk = x.data() + k * nrhs;
+            for (size_t j = 0; j < nrhs; ++j) {
+                xi[j] -= l * xk[j];
+            }
+        }
+    }
+    //U x = y
+    for (size_t i = n; i-- > 0;) {
+        double *xi = x.data() + i * nrhs;
+        for (size_t k = i + 1; k < n; ++k) {
+            double u = lu[i * n + k];
+            const double *xk = x.data() + k * nrhs;
+            for (size_t j = 0; j < nrhs; ++j) {
+                xi[j] -= u * xk[j];
+            }
+        }
+        double d = lu[i * n + i];
+        for (size_t j = 0; j < nrhs; ++j) {
+            xi[j] /= d;
+        }
+    }
+    std::copy(x.begin(), x.end(), b);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+
+// Вычислительные ядра для плотных матриц double.
+// Матрица задается указателем на первый элемент и шагами по строкам (rs) и по столбцам (cs),
+// поэтому те же ядра работают и с подматрицами, и с транспонированными представлениями
+
+
+// C = A * B, где A - m x k, B - k x n, C - m x n. Большие произведения считаются в ThreadPool
+void gemm(size_t m, size_t n, size_t k,
+          const double *a, size_t a_rs, size_t a_cs,
+          const double *b, size_t b_rs, size_t b_cs,
+          double *c, size_t c_rs, size_t c_cs);
+
+// Поэлементные операции над n подряд идущими элементами: c = a + b, c = a - b, c = a * b,
+// c = a / b, c = k * a. c может совпадать с a или b
+void vec_add(size_t n, const double *a, const double *b, double *c);
+
+void vec_sub(size_t n, const double *a, const double *b, double *c);
+
+void vec_mul(size_t n, const double *a, const double *b, double *c);
+
+void vec_div(size_t n, const double *a, const double *b, double *c);
+
+void vec_scale(size_t n, double k, const double *a, double *c);
+
+// Все элементы равны (NaN не равен ничему)
+bool vec_equal(size_t n, const double *a, const double *b);
+
+// LU-разложение n x n матрицы a (построчно, шаг n) с выбором главного элемента в столбце.
+// На месте a остаются U (на диагонали и выше) и L без единичной диагонали (ниже);
+// piv[i] - номер исходной строки, ставшей i-й, sign - знак перестановки.
+// Возвращает false, если матрица вырождена
+bool lu_decompose(size_t n, double *a, size_t *piv, int &sign);
+
+// Решает A x = b по разложению lu_decompose для nrhs правых частей сразу:
+// b - n x nrhs построчно, решение записывается на его место
+void lu_solve(size_t n, const double *lu, const size_t *piv, double *b, size_t nrhs);
@@ -0,0 +1,165 @@
+#include <cstring>
+#include <map>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "Memo.h"
+#include "Value.h"
+
+
+size_t Memo::limit = 100000;
+bool Memo::stats = false;
+std::atomic<size_t> Memo::hits(0);
+std::atomic<size_t> Memo::misses(0);
+std::atomic<size_t> Memo::epoch(0);
+std::atomic<bool> Memo::tracking(false);
+
+// Ключ длиннее этого не строится: сравнение больших матриц дороже пользы от таблицы
+static const size_t max_key = 256;
+
+typedef struct KeyHash {
+    size_t operator()(const Memo::Key &key) const {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (uint64_t w : key) {
+            h = (h ^ w) * 0x100000001b3ull;
+        }
+        return (size_t) (h ^ (h >> 29));
+    }
+} KeyHash;
+
+typedef std::vector<const std::atomic<size_t> *> Stamps;
+
+struct Memo::Table {
+    Stamps stamps;     //метки имен, от которых зависит функция
+    std::unordered_map<Key, Value, KeyHash> values;
+};
+
+// Метки имен, от которых зависит хоть одна таблица: epoch последней записи в имя.
+// Узлы std::map не перемещаются, поэтому таблицы хранят указатели на метки и читают их без блокировки
+static std::shared_mutex stamps_mutex;
+static std::map<std::string, std::atomic<size_t>> stamps;
+
+void Memo::changed(const std::string &name) {
+    if (!Memo::tracking.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::shared_lock<std::shared_mutex> lock(stamps_mutex);
+    auto it = stamps.find(name);
+    if (it != stamps.end()) {
+        it->second.store(epoch.fetch_add(1, std::memory_order_acq_rel) + 1, std::memory_order_release);
+    }
+}
+
+// Метки для имен: записи в эти имена с этого момента меняют epoch
+static Stamps track(const std::vector<std::string> &names) {
+    Stamps res;
+    if (names.empty()) {
+        return res;
+    }
+    std::unique_lock<std::shared_mutex> lock(stamps_mutex);
+    for (auto &name : names) {
+        res.push_back(&stamps.try_emplace(name, 0).first->second);
+    }
+    Memo::tracking.store(true, std::memory_order_release);
+    return res;
+}
+
+// Изменилось ли после since хоть одно из имен
+static bool changed_since(const Stamps &names, size_t since) {
+    for (auto *stamp : names) {
+        if (stamp->load(std::memory_order_acquire) > since) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Memo::Memo() : checked(SIZE_MAX), enabled(false) {}
+
+Memo::~Memo() = default;
+
+static uint64_t bits(double d) {
+    uint64_t w;
+    std::memcpy(&w, &d, sizeof(w));
+    return w;
+}
+
+// Числа и матрицы - по битам значений, тип и размерность - одним словом;
+// функции и неопределенные значения ключом быть не могут
+static bool make_key(const std::vector<Value> &args, Memo::Key &key) {
+    for (auto &a : args) {
+        Value::Type t = a.type();
+        uint64_t meta = ((uint64_t) t << 56) | a.dimension().word();
+        if (t == Value::DOUBLE || t == Value::INFERRED_DOUBLE) {
+            key.push_back(meta);
+            key.push_back(bits(a.get_double()));
+        } else if (t == Value::MATRIX || t == Value::INFERRED_MATRIX) {
+            const Matrix &m = a.get_matrix();
+            if (key.size() + 2 + m.size() > max_key) {
+                return false;
+            }
+            key.push_back(meta);
+            key.push_back(((uint64_t) m.rows() << 32) | m.cols());
+            for (size_t i = 0; i < m.rows(); ++i) {
+                for (size_t j = 0; j < m.cols(); ++j) {
+                    key.push_back(bits(m(i, j)));
+                }
+            }
+        } else {
+            return false;
+        }
+    }
+    return key.size() <= max_key;
+}
+
+bool Memo::find(const Func *f, const std::vector<Value> &args, Key &key, Value &res) {
+    if (!limit) {
+        return false;
+    }
+    size_t now = epoch.load(std::memory_order_acquire);
+    if (checked.load(std::memory_order_acquire) != now) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!table) {
+            table.reset(new Table());
+        }
+        size_t since = checked.load(std::memory_order_relaxed);
+        if (since != now) {
+            //чистота зависит от global: имена, в которые пишет тело, и вызываемые функции ищутся там
+            if (since == SIZE_MAX || changed_since(table->stamps, since)) {
+                table->values.clear();
+                table->stamps = track(Node::dependencies(f));
+                now = epoch.load(std::memory_order_acquire);    //записи до появления меток не отмечены
+                enabled.store(Node::is_pure(f) && f->body->is_costly(), std::memory_order_relaxed);
+            }
+            checked.store(now, std::memory_order_release);
+        }
+    }
+    if (!enabled.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    if (!make_key(args, key)) {
+        key.clear();
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = table->values.find(key);
+    if (it != table->values.end()) {
+        res = it->second;
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void Memo::store(Key key, const Value &res) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t since = checked.load(std::memory_order_relaxed);
+    if (since != epoch.load(std::memory_order_acquire) && changed_since(table->stamps, since)) {
+        return;
+    }
+    if (table->values.size() >= limit) {    //переполненная таблица начинается заново
+        table->values.clear();
+    }
+    table->values.emplace(std::move(key), res);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+class Value;
+
+struct Func;
+
+
+// Таблица запомненных результатов одной функции: аргументы -> значение.
+// Запоминаются только чистые функции (см. Node::is_pure), в теле которых есть вызовы или циклы:
+// простое выражение вычислить быстрее, чем найти в таблице. Чистая функция все же может читать
+// глобальные имена (Node::dependencies). Запись в такое имя увеличивает epoch и ставит имени метку;
+// таблица очищается (и чистота проверяется заново), только если метка одного из ее имен новее проверки.
+// Записи в остальные имена epoch не меняют. Пока epoch не изменился, find не берет блокировку для
+// проверки таблицы, а у незапоминаемой функции не берет ее совсем. Таблицу используют одновременно
+// несколько потоков (\graphic)
+class Memo {
+public:
+    typedef std::vector<uint64_t> Key;
+
+    static size_t limit;        //--memo-limit: записей в таблице одной функции
+    static bool stats;          //--memo-stats: напечатать число попаданий и промахов
+    static std::atomic<size_t> hits;
+    static std::atomic<size_t> misses;
+    static std::atomic<size_t> epoch;   //число записей в global в имена, от которых зависят таблицы
+
+    static std::atomic<bool> tracking;  //есть имена, от которых зависят таблицы; иначе записи в global не отмечаются
+
+    // Запись в global по имени name
+    static void changed(const std::string &name);
+
+    Memo();
+
+    ~Memo();
+
+    Memo(const Memo &) = delete;
+
+    Memo &operator=(const Memo &) = delete;
+
+    // true и res - если результат уже есть. Иначе key - ключ для store,
+    // пустой, если этот вызов запоминать нельзя
+    bool find(const Func *f, const std::vector<Value> &args, Key &key, Value &res);
+
+    void store(Key key, const Value &res);
+
+private:
+    struct Table;
+
+    std::mutex mutex;
+    std::unique_ptr<Table> table;
+    std::atomic<size_t> checked;    //epoch последней сверки таблицы с изменениями global; SIZE_MAX - не сверялась
+    std::atomic<bool> enabled;      //функцию можно запоминать (по состоянию на checked)
+};
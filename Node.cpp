@@ -31,9 +31,12 @@ void Parser::init(std::vector<Token> &ts) {
 
 Node::Node() = default;
 
-Node::Node(const Node &n) : _coord(n._coord), _tag(n._tag), _label(n._label), _priority(n._priority) {
+Node::Node(const Node &n) :
+_coord(n._coord), _tag(n._tag), _label(n._label), _priority(n._priority), _captures(n._captures),
+_body(n._body), _slot(n._slot) {
     if (n.left) left = new Node(*n.left);
-    if (n.right) right = new Node(*n.right);
+    if (_body) right = const_cast<Node *>(_body.get());   //тело неизменяемо и разделяется
+    else if (n.right) right = new Node(*n.right);
     if (n.cond) cond = new Node(*n.cond);
     for (auto field : n.fields) {
         fields.push_back(new Node(*field));
@@ -42,7 +45,7 @@ Node::Node(const Node &n) : _coord(n._coord), _tag(n._tag), _label(n._label), _p
 
 Node::~Node() {
     delete left;
-    delete right;
+    if (!_body) delete right;
     delete cond;
     for (auto & field : fields) {
         delete field;
@@ -203,6 +206,31 @@ std::vector<Node *> Parser::list(Tag close) {  //список аргументо
     return res;
 }
 
+std::vector<Node *> Parser::index() {   //список индексов, * вместо индекса - вся строка или весь столбец
+    std::vector<Node *> res;
+    Tag next;
+    Parser::next();    //скипнуть {
+    do {
+        Token *t = cur();
+        Tag after = program[i + 1]._tag;
+        if (t->_tag == MUL && (after == COMMA || after == RBRACE)) {
+            get();
+            t->_tag = SLICE;
+            res.push_back(new Node(t));
+        } else {
+            res.push_back(expression(0));
+        }
+        next = get()->_tag;
+    } while (next == COMMA);
+    if (next != RBRACE) {
+        for (auto & re : res) {
+            delete re;
+        }
+        throw Error(cur()->start.start, "List not closed");
+    }
+    return res;
+}
+
 Node *Parser::binexpr(Token *rhs, Node *lhs) {
     rhs->binary();
     Node *res = new Node(rhs);
@@ -252,8 +280,8 @@ Node *Parser::unexpr(Token *t) {
     else if (res->_tag == IDENT) {
         if (cur()->_tag == INDEX) {  //обращение по индексу
             get();
-            if (cur()->_tag == LBRACE) { //составной индекс: x_{1+2+3}, y_{q,w}
-                res->fields = list(RBRACE);
+            if (cur()->_tag == LBRACE) { //составной индекс: x_{1+2+3}, y_{q,w}, строка и столбец: A_{i,*}, A_{*,j}
+                res->fields = index();
                 if (res->fields.size() < 1 || res->fields.size() > 2) {
                     throw Error(res->_coord, "Bad index");
                 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <set>
+#include <memory>
 #include "Coordinate.h"
 
 
@@ -35,6 +37,8 @@ typedef struct Parser {
 
 	std::vector<Node *> list(Tag close);
 
+	std::vector<Node *> index();
+
 	std::vector<Node *> matrix();
 
 	Node * arg(Tag open);
@@ -46,6 +50,12 @@ typedef struct Parser {
 typedef std::map<std::string, Value> name_table;
 
 
+struct Frame;
+
+
+struct Func;
+
+
 struct Replacement;
 
 
@@ -54,11 +64,15 @@ typedef std::map<Coordinate, Replacement> replacement_map;
 
 class Node {
 	friend struct Parser;
+	friend class BatchExpr;
 
 	Coordinate _coord;
 	Tag _tag = ERROR;
 	std::string _label;
 	int _priority = 0;
+	std::vector<std::string> _captures;  //для объявления функции: имена, на которые ссылается тело; копируются при объявлении
+	std::shared_ptr<const Node> _body;   //для объявления функции: владелец тела (right), общий с Func
+	int _slot = -1; //номер аргумента функции, в теле которой находится имя, иначе -1
 public:
 	static name_table global;
 	static replacement_map reps;
@@ -87,13 +101,50 @@ public:
 
     std::string& toString();
 
-	Value exec(name_table *nt);
+	Value exec(Frame *frame) const;
 
 	static void copy_defs(name_table &local, name_table *ptr);
 
-	static Value &lookup(const std::string& name, name_table *ptr, const Coordinate&);
+	static Value &lookup(const std::string& name, Frame *frame, const Coordinate&, int slot = -1);
+
+	static Value &lookup_for_write(const std::string& name, Frame *frame, const Coordinate&, int slot = -1);
 
-	static void def(const std::string& name, const Value&, name_table *ptr);
+	static void def(const std::string& name, Value, Frame *frame, int slot = -1);
 
     void semantic_analysis();
+
+    void optimize();
+
+    static bool is_pure(const Func *f);
+
+    static std::vector<std::string> dependencies(const Func *f);
+
+    bool is_costly() const;
+
+private:
+    bool calls_function() const;
+
+    bool collect_assigned(std::set<std::string> &names) const;
+
+    bool is_invariant(const std::set<std::string> &assigned) const;
+
+    bool is_trivial() const;
+
+    bool is_pure(const Func *f, std::set<const Func *> &seen) const;
+
+    const Func *resolve_callee(const Func *f) const;
+
+    bool is_pure_callee(const Func *f, std::set<const Func *> &seen) const;
+
+    void collect_dependencies(const Func *f, std::set<std::string> &names, std::set<const Func *> &seen) const;
+
+    void collect_names(std::set<std::string> &names) const;
+
+    void bind_slots(const std::vector<std::string> &params);
+
+    static void hoist(Node *&n, const std::set<std::string> &assigned, std::vector<Node *> &hoisted);
+
+    static long index_value(const Node *n, Frame *scope, const Coordinate &pos);
+
+    static void eval_index(const std::vector<Node *> &idx, Frame *scope, const Coordinate &pos, long &i, long &j);
 };
\ No newline at end of file
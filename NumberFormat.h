@@ -0,0 +1,26 @@
+#pragma once
+
+#include <charconv>
+#include <string>
+
+
+// Запись чисел прямо в конец строки, без промежуточных строк и потоков.
+// std::to_chars с фиксированной точностью дает тот же текст, что printf("%.*f")
+
+// Больше знаков после точки double все равно не различает
+static const int max_fixed_precision = 30;
+
+inline void append_fixed(std::string &out, double d, int precision) {
+    //целая часть double - не больше 309 цифр
+    char buf[320 + max_fixed_precision];
+    if (precision > max_fixed_precision) precision = max_fixed_precision;
+    if (precision < 0) precision = 0;
+    auto res = std::to_chars(buf, buf + sizeof(buf), d, std::chars_format::fixed, precision);
+    out.append(buf, res.ptr);
+}
+
+inline void append_integer(std::string &out, long n) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), n);
+    out.append(buf, res.ptr);
+}
@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "Numeric.h"
+
+
+double Numeric::tolerance = 1e-10;
+size_t Numeric::max_intervals = 1000;
+size_t Numeric::max_iterations = 200;
+double Numeric::ode_tolerance = 1e-6;
+size_t Numeric::max_steps = 100000;
+
+//узлы Кронрода на [0, 1] по убыванию; узлы Гаусса - нечетные из них, последний узел - середина
+static const double xgk[8] = {
+        0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245, 0.000000000000000000000000000000000
+};
+
+static const double wgk[8] = {
+        0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+};
+
+static const double wg[4] = {
+        0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975, 0.417959183673469387755102040816327
+};
+
+static const size_t gk_points = 15;
+
+typedef struct Piece {
+    double a, b;
+    double value;   //интеграл по отрезку
+    double error;   //оценка погрешности
+    double abs;     //интеграл модуля: масштаб для ошибок округления
+} Piece;
+
+static bool less_error(const Piece &l, const Piece &r) {
+    return l.error < r.error;
+}
+
+// Узлы отрезка [a, b] в порядке: середина, затем пары симметричных узлов
+static void nodes(double a, double b, double *xs) {
+    double c = 0.5 * (a + b), h = 0.5 * (b - a);
+    xs[0] = c;
+    for (size_t k = 0; k < 7; ++k) {
+        xs[1 + 2 * k] = c - h * xgk[k];
+        xs[2 + 2 * k] = c + h * xgk[k];
+    }
+}
+
+// Правило 15 точек по значениям в узлах nodes; оценка погрешности как в QUADPACK (qk15)
+static Piece rule(double a, double b, const double *ys) {
+    double h = 0.5 * (b - a), dh = std::abs(h);
+    double fc = ys[0];
+    double resk = fc * wgk[7], resg = fc * wg[3], resabs = std::abs(resk);
+    for (size_t k = 0; k < 7; ++k) {
+        double f1 = ys[1 + 2 * k], f2 = ys[2 + 2 * k];
+        resk += wgk[k] * (f1 + f2);
+        resabs += wgk[k] * (std::abs(f1) + std::abs(f2));
+        if (k % 2 == 1) {
+            resg += wg[k / 2] * (f1 + f2);
+        }
+    }
+    double mean = 0.5 * resk;
+    double resasc = wgk[7] * std::abs(fc - mean);
+    for (size_t k = 0; k < 7; ++k) {
+        resasc += wgk[k] * (std::abs(ys[1 + 2 * k] - mean) + std::abs(ys[2 + 2 * k] - mean));
+    }
+    Piece p{a, b, resk * h, std::abs((resk - resg) * h), resabs * dh};
+    resasc *= dh;
+    if (resasc != 0.0 && p.error != 0.0) {
+        p.error = resasc * std::min(1.0, std::pow(200.0 * p.error / resasc, 1.5));
+    }
+    if (p.abs > DBL_MIN / (50.0 * DBL_EPSILON)) {
+        p.error = std::max(50.0 * DBL_EPSILON * p.abs, p.error);
+    }
+    return p;
+}
+
+bool Numeric::integrate(double a, double b, const PlotBatch &f, double &res) {
+    double xs[2 * gk_points], ys[2 * gk_points];
+    nodes(a, b, xs);
+    f(xs, ys, gk_points);
+
+    std::vector<Piece> heap;    //куча по оценке погрешности
+    heap.push_back(rule(a, b, ys));
+    double value = heap[0].value, error = heap[0].error, abs = heap[0].abs;
+    bool ok = false;
+    while (true) {
+        //предел снизу - погрешность округления, которую правило закладывает в каждую оценку
+        if (error <= std::max(tolerance * std::abs(value), 100.0 * DBL_EPSILON * abs)) {
+            ok = true;
+            break;
+        }
+        if (!std::isfinite(value) || heap.size() >= max_intervals) {
+            break;
+        }
+        std::pop_heap(heap.begin(), heap.end(), less_error);
+        Piece worst = heap.back();
+        heap.pop_back();
+        double mid = 0.5 * (worst.a + worst.b);
+        if (mid == worst.a || mid == worst.b) {     //отрезок уже не делится
+            heap.push_back(worst);
+            break;
+        }
+        nodes(worst.a, mid, xs);
+        nodes(mid, worst.b, xs + gk_points);
+        f(xs, ys, 2 * gk_points);
+        Piece l = rule(worst.a, mid, ys), r = rule(mid, worst.b, ys + gk_points);
+        value += l.value + r.value - worst.value;
+        error += l.error + r.error - worst.error;
+        abs += l.abs + r.abs - worst.abs;
+        heap.push_back(l);
+        std::push_heap(heap.begin(), heap.end(), less_error);
+        heap.push_back(r);
+        std::push_heap(heap.begin(), heap.end(), less_error);
+    }
+    //суммы, обновляемые на каждом шаге, накапливают ошибку округления - результат пересчитывается
+    res = 0.0;
+    for (auto &p : heap) {
+        res += p.value;
+    }
+    return ok;
+}
+
+bool Numeric::find_root(double a, double b, double fa, double fb, const PlotBatch &f, double &res) {
+    //абсолютный допуск от масштаба отрезка: корень в нуле тоже находится за конечное число шагов
+    double xtol = DBL_EPSILON * (std::abs(a) + std::abs(b));
+    double c = b, fc = fb, d = b - a, e = d;
+    for (size_t it = 0; it < max_iterations; ++it) {
+        if ((fb > 0.0 && fc > 0.0) || (fb < 0.0 && fc < 0.0)) {
+            c = a;
+            fc = fa;
+            d = e = b - a;
+        }
+        if (std::abs(fc) < std::abs(fb)) {
+            a = b;
+            b = c;
+            c = a;
+            fa = fb;
+            fb = fc;
+            fc = fa;
+        }
+        double tol = 2.0 * DBL_EPSILON * std::abs(b) + 0.5 * xtol;
+        double m = 0.5 * (c - b);
+        if (std::abs(m) <= tol || fb == 0.0) {
+            res = b;
+            return true;
+        }
+        if (std::abs(e) >= tol && std::abs(fa) > std::abs(fb)) {
+            double s = fb / fa, p, q;
+            if (a == c) {   //секущая
+                p = 2.0 * m * s;
+                q = 1.0 - s;
+            } else {        //обратная квадратичная интерполяция
+                double r = fb / fc;
+                q = fa / fc;
+                p = s * (2.0 * m * q * (q - r) - (b - a) * (r - 1.0));
+                q = (q - 1.0) * (r - 1.0) * (s - 1.0);
+            }
+            if (p > 0.0) {
+                q = -q;
+            } else {
+                p = -p;
+            }
+            if (2.0 * p < std::min(3.0 * m * q - std::abs(tol * q), std::abs(e * q))) {
+                e = d;
+                d = p / q;
+            } else {
+                d = m;
+                e = d;
+            }
+        } else {
+            d = m;
+            e = d;
+        }
+        a = b;
+        fa = fb;
+        b += (std::abs(d) > tol) ? d : std::copysign(tol, m);
+        f(&b, &fb, 1);
+        if (std::isnan(fb)) {
+            break;
+        }
+    }
+    res = b;
+    return false;
+}
+
+//коэффициенты Дормана-Принса: узлы, матрица стадий, веса решения 5-го порядка (последняя строка a)
+//и разности весов 5-го и 4-го порядков для оценки погрешности
+static const double dp_c[7] = {0.0, 1.0 / 5, 3.0 / 10, 4.0 / 5, 8.0 / 9, 1.0, 1.0};
+
+static const double dp_a[7][6] = {
+        {},
+        {1.0 / 5},
+        {3.0 / 40, 9.0 / 40},
+        {44.0 / 45, -56.0 / 15, 32.0 / 9},
+        {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729},
+        {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656},
+        {35.0 / 384, 0.0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84}
+};
+
+static const double dp_e[7] = {
+        71.0 / 57600, 0.0, -71.0 / 16695, 71.0 / 1920, -17253.0 / 339200, 22.0 / 525, -1.0 / 40
+};
+
+// Среднеквадратичная норма v с весами допуска: 1 - ровно на границе допуска
+static double weighted_norm(const std::vector<double> &v, const std::vector<double> &scale) {
+    double sum = 0.0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        double r = v[i] / scale[i];
+        sum += r * r;
+    }
+    return v.empty() ? 0.0 : std::sqrt(sum / (double) v.size());
+}
+
+bool Numeric::ode_solve(double t0, double t1, const std::vector<double> &y0, const OdeRhs &f,
+                        std::vector<double> &out) {
+    size_t n = y0.size();
+    std::vector<double> y = y0, ynew(n), tmp(n), err(n), scale(n);
+    std::vector<std::vector<double>> k(7, std::vector<double>(n));
+    out.push_back(t0);
+    out.insert(out.end(), y.begin(), y.end());
+    if (t0 == t1) {
+        return true;
+    }
+
+    //абсолютная часть допуска - от масштаба начального состояния: иначе компоненты,
+    //проходящие через ноль, требовали бы недостижимой относительной точности
+    double floor = 0.0;
+    for (double v : y0) {
+        floor = std::max(floor, std::abs(v));
+    }
+    floor = 1e-3 * (floor > 0.0 ? floor : 1.0);
+    auto set_scale = [&](const std::vector<double> &a, const std::vector<double> &b) {
+        for (size_t i = 0; i < n; ++i) {
+            scale[i] = ode_tolerance * (std::max(std::abs(a[i]), std::abs(b[i])) + floor);
+        }
+    };
+
+    //начальный шаг (Хайрер, Нёрсетт, Ваннер): по величине решения и производной и по пробному шагу Эйлера
+    double dir = (t1 > t0) ? 1.0 : -1.0, span = std::abs(t1 - t0);
+    f(t0, y.data(), k[0].data());
+    set_scale(y, y);
+    double d0 = weighted_norm(y, scale), d1 = weighted_norm(k[0], scale);
+    double h = (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 * span : 0.01 * d0 / d1;
+    h = std::min(h, span);
+    for (size_t i = 0; i < n; ++i) {
+        tmp[i] = y[i] + dir * h * k[0][i];
+    }
+    f(t0 + dir * h, tmp.data(), k[1].data());
+    for (size_t i = 0; i < n; ++i) {
+        err[i] = k[1][i] - k[0][i];
+    }
+    double d2 = weighted_norm(err, scale) / h;
+    double h1 = (std::max(d1, d2) <= 1e-15) ? std::max(1e-6 * span, h * 1e-3)
+                                           : std::pow(0.01 / std::max(d1, d2), 0.2);
+    h = std::min({100.0 * h, h1, span});
+
+    double t = t0;
+    for (size_t steps = 0; steps < max_steps; ++steps) {
+        bool last = false;
+        if (h >= std::abs(t1 - t)) {
+            h = std::abs(t1 - t);
+            last = true;
+        }
+        double hs = dir * h;
+        if (t + hs == t) {
+            return false;
+        }
+        //k[0] уже содержит f(t, y): последняя стадия принятого шага совпадает с первой следующего
+        for (size_t s = 1; s < 7; ++s) {
+            for (size_t i = 0; i < n; ++i) {
+                double acc = y[i];
+                for (size_t j = 0; j < s; ++j) {
+                    acc += hs * dp_a[s][j] * k[j][i];
+                }
+                (s == 6 ? ynew : tmp)[i] = acc;
+            }
+            f(last && s >= 5 ? t1 : t + dp_c[s] * hs, (s == 6 ? ynew : tmp).data(), k[s].data());
+        }
+        for (size_t i = 0; i < n; ++i) {
+            double e = 0.0;
+            for (size_t s = 0; s < 7; ++s) {
+                e += dp_e[s] * k[s][i];
+            }
+            err[i] = hs * e;
+        }
+        set_scale(y, ynew);
+        double norm = weighted_norm(err, scale);
+        if (!std::isfinite(norm)) {
+            return false;
+        }
+        //новый шаг по оценке погрешности 5-го порядка с запасом 0.9, не больше чем в 5 раз за шаг
+        double factor = (norm == 0.0) ? 5.0 : std::min(5.0, std::max(0.2, 0.9 * std::pow(norm, -0.2)));
+        if (norm <= 1.0) {
+            t = last ? t1 : t + hs;
+            y.swap(ynew);
+            k[0].swap(k[6]);
+            out.push_back(t);
+            out.insert(out.end(), y.begin(), y.end());
+            if (last) {
+                return true;
+            }
+            h *= factor;
+        } else {
+            h *= std::min(1.0, factor);
+        }
+    }
+    return false;
+}
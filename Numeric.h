@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "Plot.h"
+
+
+// Правая часть системы y' = f(t, y) из n уравнений: dy = f(t, y)
+typedef std::function<void(double t, const double *y, double *dy)> OdeRhs;
+
+// Численные методы для \integral, \findroot и \odesolve. Функция одного аргумента передается
+// так же, как в Plot, - вычислителем пачки точек: квадратура за один вызов считает все узлы
+// обеих половин отрезка
+class Numeric {
+public:
+    static double tolerance;        //допустимая относительная погрешность интеграла
+    static size_t max_intervals;    //наибольшее число отрезков разбиения при интегрировании
+    static size_t max_iterations;   //наибольшее число шагов поиска корня
+    static double ode_tolerance;    //допустимая относительная погрешность шага ОДУ
+    static size_t max_steps;        //наибольшее число шагов решения ОДУ
+
+    // Адаптивная квадратура Гаусса-Кронрода (7 узлов Гаусса, 15 узлов Кронрода): пополам
+    // делится отрезок с наибольшей оценкой погрешности, пока сумма оценок не станет меньше
+    // tolerance от модуля интеграла. false, если точность не достигнута за max_intervals отрезков
+    static bool integrate(double a, double b, const PlotBatch &f, double &res);
+
+    // Метод Брента на [a, b], где fa и fb - значения на концах разных знаков: обратная
+    // квадратичная интерполяция, а если она выводит за отрезок или сходится медленно - деление пополам.
+    // false, если корень не уточнен до машинной точности за max_iterations шагов
+    static bool find_root(double a, double b, double fa, double fb, const PlotBatch &f, double &res);
+
+    // Метод Дормана-Принса 5(4) с выбором шага на [t0, t1] (t1 может быть меньше t0) от y0.
+    // В out дописываются строки (t, y_1, ..., y_n) подряд: начальная точка и конец каждого принятого шага,
+    // последний шаг заканчивается ровно в t1. false, если не хватило max_steps шагов или шаг стал
+    // меньше точности представления t
+    static bool ode_solve(double t0, double t1, const std::vector<double> &y0, const OdeRhs &f,
+                          std::vector<double> &out);
+};
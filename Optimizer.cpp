@@ -0,0 +1,330 @@
+#include <set>
+#include <string>
+#include <algorithm>
+
+#include "Node.h"
+#include "Value.h"
+
+
+// счетчик для имен вынесенных выражений; '#' не может встретиться в IDENT из текста,
+// поэтому такие имена не пересекаются с пользовательскими
+static size_t invariant_count = 0;
+
+// Оптимизации дерева блока. Выполняются после семантического анализа и до exec
+void Node::optimize() {
+    if (left) left->optimize();
+    if (right) right->optimize();
+    if (cond) cond->optimize();
+    for (auto & field : fields) {
+        field->optimize();
+    }
+
+    // вынос инвариантов из тела цикла: выражения, входы которых не присваиваются
+    // в цикле, вычисляются один раз перед первой итерацией (см. exec для WHILE)
+    if ((_tag == WHILE || _tag == PRODUCT) && fields.empty()) {
+        std::set<std::string> assigned;
+        if (cond->collect_assigned(assigned) && right->collect_assigned(assigned)) {
+            hoist(right, assigned, fields);
+        }
+    }
+
+    // свободные переменные тела функции: при объявлении замыкание копирует только их,
+    // а не всю текущую таблицу имен. Правило одно для имен кадра и global: значение берется
+    // на момент объявления (снимок), даже у функции, объявленной внутри другой функции
+    if (_tag == SET && left->_tag == FUNC) {
+        std::set<std::string> names;
+        right->collect_names(names);
+        for (auto field : left->fields) {   //аргументы все равно перезаписываются при вызове
+            names.erase(field->_label);
+        }
+        names.erase(left->_label);          //имя функции в теле - она сама (см. Frame::self)
+        _captures.assign(names.begin(), names.end());
+
+        std::vector<std::string> params;
+        for (auto field : left->fields) {
+            params.push_back(field->_label);
+        }
+        right->bind_slots(params);
+
+        //тело больше не меняется: дальше им владеют объявление и созданные из него Func,
+        //и функция держит только свое тело, а не все дерево блока
+        _body = std::shared_ptr<const Node>(right);
+    }
+}
+
+// Имена аргументов в теле функции читаются из слотов кадра вызова, без поиска по таблицам.
+// Тела вложенных объявлений уже связаны со своими аргументами (обход снизу вверх),
+// а аргументы внешней функции они получают через замыкание, поэтому туда не спускаемся
+void Node::bind_slots(const std::vector<std::string> &params) {
+    if (_tag == IDENT || _tag == FUNC || _tag == GRAPHIC) {
+        auto it = std::find(params.begin(), params.end(), _label);
+        if (it != params.end()) {
+            _slot = (int) (it - params.begin());
+        }
+    }
+    if (_tag == SET && left->_tag == FUNC) {
+        auto it = std::find(params.begin(), params.end(), left->_label);
+        if (it != params.end()) {
+            left->_slot = (int) (it - params.begin());
+        }
+        return;
+    }
+    if (left) left->bind_slots(params);
+    if (right) right->bind_slots(params);
+    if (cond) cond->bind_slots(params);
+    for (auto field : fields) {
+        field->bind_slots(params);
+    }
+}
+
+// Все имена, которые поддерево читает или изменяет через таблицу имен, включая
+// тела вложенных объявлений функций: они захватывают значения из локальной таблицы
+void Node::collect_names(std::set<std::string> &names) const {
+    if (_tag == IDENT || _tag == FUNC || _tag == GRAPHIC) {
+        names.insert(_label);
+    }
+    if (left) left->collect_names(names);
+    if (right) right->collect_names(names);
+    if (cond) cond->collect_names(names);
+    for (auto field : fields) {
+        field->collect_names(names);
+    }
+}
+
+// Вызов пользовательской функции: FUNC или встроенная функция из funcs_numeric (\integral,
+// \findroot, \odesolve), которая вызывает переданную ей функцию. Все проверки оптимизатора
+// смотрят сюда, поэтому новую встроенную функцию такого рода достаточно добавить в funcs_numeric
+bool Node::calls_function() const {
+    return _tag == FUNC || (_tag == KEYWORD && funcs_numeric.count(_label));
+}
+
+// Собирает имена, которым что-то присваивается в поддереве (через Node::def или по индексу).
+// Возвращает false, если в поддереве есть вызовы функций (в том числе через \integral и т.п.):
+// тело функции может переопределить глобальные переменные, и множество присваиваемых имен неизвестно
+bool Node::collect_assigned(std::set<std::string> &names) const {
+    if (calls_function() || _tag == GRAPHIC) {
+        return false;
+    }
+    if (_tag == SET) {
+        names.insert(left->_label);
+        if (left->_tag == FUNC) {   //тело объявляемой функции в цикле не выполняется
+            return true;
+        }
+        for (auto field : left->fields) {
+            if (!field->collect_assigned(names)) return false;
+        }
+        return right->collect_assigned(names);
+    }
+    if (left && !left->collect_assigned(names)) return false;
+    if (right && !right->collect_assigned(names)) return false;
+    if (cond && !cond->collect_assigned(names)) return false;
+    for (auto field : fields) {
+        if (!field->collect_assigned(names)) return false;
+    }
+    return true;
+}
+
+// Выражение без побочных эффектов, не зависящее от присваиваемых в цикле имен
+bool Node::is_invariant(const std::set<std::string> &assigned) const {
+    switch (_tag) {
+        case NUMBER:
+        case DIMENSION:
+        case SLICE:
+            return true;
+        case IDENT:
+            if (assigned.count(_label)) return false;
+            break;
+        case KEYWORD:
+            if (calls_function()) return false;
+            break;
+        case BEGINM:
+        case LIST:
+        case UADD:
+        case USUB:
+        case LPAREN:
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case FRAC:
+        case POW:
+        case ABS:
+        case TRANSP:
+        case NOT:
+        case LT:
+        case GT:
+        case LEQ:
+        case GEQ:
+        case NEQ:
+        case AND:
+        case OR:
+            break;
+        default:
+            return false;
+    }
+    if (left && !left->is_invariant(assigned)) return false;
+    if (right && !right->is_invariant(assigned)) return false;
+    if (cond && !cond->is_invariant(assigned)) return false;
+    for (auto field : fields) {
+        if (!field->is_invariant(assigned)) return false;
+    }
+    return true;
+}
+
+// Функцию можно вызывать из нескольких потоков одновременно, если ее тело (и тела функций,
+// которые оно вызывает) не пишет в global и не создает подстановок: все остальные
+// изменения остаются в кадре вызова
+bool Node::is_pure(const Func *f) {
+    std::set<const Func *> seen;
+    seen.insert(f);
+    return f->body->is_pure(f, seen);
+}
+
+bool Node::is_pure(const Func *f, std::set<const Func *> &seen) const {
+    switch (_tag) {
+        case PLACEHOLDER:
+        case GRAPHIC:
+            return false;
+        case SET:
+            if (left->_tag != IDENT || global.count(left->_label)) return false;
+            break;
+        case FUNC:
+            if (!is_pure_callee(f, seen)) return false;
+            break;
+        case KEYWORD:
+            //\integral(g, a, b) и т.п. вызывают g: имя g проверяется как вызываемая функция
+            if (calls_function() && (fields.empty() || fields[0]->_tag != IDENT ||
+                                     !fields[0]->fields.empty() || !fields[0]->is_pure_callee(f, seen))) {
+                return false;
+            }
+            break;
+        default:
+            break;
+    }
+    if (left && !left->is_pure(f, seen)) return false;
+    if (right && !right->is_pure(f, seen)) return false;
+    if (cond && !cond->is_pure(f, seen)) return false;
+    for (auto field : fields) {
+        if (!field->is_pure(f, seen)) return false;
+    }
+    return true;
+}
+
+// Функция с именем _label ищется так же, как при вызове; аргумент-функцию найти нельзя (nullptr)
+const Func *Node::resolve_callee(const Func *f) const {
+    if (_slot >= 0) return nullptr;
+    if (_label == f->name) return f;
+    auto it = f->local.find(_label);
+    if (it == f->local.end()) {
+        it = global.find(_label);
+        if (it == global.end()) return nullptr;
+    }
+    if (it->second.type() != Value::FUNCTION) return nullptr;
+    return it->second.get_function();
+}
+
+bool Node::is_pure_callee(const Func *f, std::set<const Func *> &seen) const {
+    const Func *callee = resolve_callee(f);
+    if (!callee) return false;
+    return !seen.insert(callee).second || callee->body->is_pure(callee, seen);
+}
+
+// Имена, от которых зависят чистота и результат f: имена в теле f и в телах функций,
+// которые она вызывает или передает в \integral и т.п. Запись в global других имен их не меняет
+std::vector<std::string> Node::dependencies(const Func *f) {
+    std::set<std::string> names;
+    std::set<const Func *> seen;
+    seen.insert(f);
+    f->body->collect_dependencies(f, names, seen);
+    return {names.begin(), names.end()};
+}
+
+void Node::collect_dependencies(const Func *f, std::set<std::string> &names, std::set<const Func *> &seen) const {
+    if (_tag == IDENT || _tag == FUNC || _tag == GRAPHIC) {
+        names.insert(_label);
+        const Func *callee = resolve_callee(f);
+        if (callee && seen.insert(callee).second) {
+            callee->body->collect_dependencies(callee, names, seen);
+        }
+    }
+    if (left) left->collect_dependencies(f, names, seen);
+    if (right) right->collect_dependencies(f, names, seen);
+    if (cond) cond->collect_dependencies(f, names, seen);
+    for (auto field : fields) {
+        field->collect_dependencies(f, names, seen);
+    }
+}
+
+// Тело с вызовами или циклами: результат такой функции стоит запоминать (см. Memo)
+bool Node::is_costly() const {
+    if (calls_function() || _tag == WHILE || _tag == PRODUCT || _tag == SUM) return true;
+    if (left && left->is_costly()) return true;
+    if (right && right->is_costly()) return true;
+    if (cond && cond->is_costly()) return true;
+    for (auto field : fields) {
+        if (field->is_costly()) return true;
+    }
+    return false;
+}
+
+// Выносить листья нет смысла: их вычисление не дороже обращения к временной переменной
+bool Node::is_trivial() const {
+    return _tag == NUMBER || _tag == DIMENSION || _tag == SLICE ||
+           ((_tag == IDENT || _tag == KEYWORD) && fields.empty());
+}
+
+// Обходит только позиции, которые вычисляются на каждой итерации безусловно:
+// вынесенное выражение считается до тела цикла, и в ветке, которая не выполнилась бы,
+// оно могло бы бросить ошибку, которой в исходной программе нет
+void Node::hoist(Node *&n, const std::set<std::string> &assigned, std::vector<Node *> &hoisted) {
+    if (!n) {
+        return;
+    }
+    if (n->is_invariant(assigned)) {
+        if (n->is_trivial()) {
+            return;
+        }
+        auto *var = new Node();
+        var->set_tag(IDENT);
+        var->_label = "#licm" + std::to_string(invariant_count++);
+        var->_coord = n->_coord;
+
+        auto *set = new Node();
+        set->set_tag(SET);
+        set->_coord = n->_coord;
+        set->left = var;
+        set->right = n;
+        hoisted.push_back(set);
+
+        n = new Node(*var);
+        return;
+    }
+    switch (n->_tag) {
+        case IF:
+        case WHILE:
+        case PRODUCT:
+            hoist(n->cond, assigned, hoisted);
+            break;
+        case EQ:
+            hoist(n->left, assigned, hoisted);
+            break;
+        case SET:
+            if (n->left->_tag == IDENT) {
+                for (auto & field : n->left->fields) {
+                    hoist(field, assigned, hoisted);
+                }
+                hoist(n->right, assigned, hoisted);
+            }
+            break;
+        case BEGINC:
+        case GRAPHIC:
+            break;
+        default:
+            hoist(n->left, assigned, hoisted);
+            hoist(n->right, assigned, hoisted);
+            for (auto & field : n->fields) {
+                hoist(field, assigned, hoisted);
+            }
+            break;
+    }
+}
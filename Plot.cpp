@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+#include "Plot.h"
+#include "NumberFormat.h"
+
+
+bool Plot::adaptive = false;
+double Plot::tolerance = 1e-3;
+size_t Plot::min_points = 32;
+size_t Plot::max_points = 2000;
+int Plot::precision = 6;
+double Plot::simplify = 0.0;
+bool Plot::data_files = false;
+
+Matrix Plot::uniform(const Matrix &range, const PlotBatch &f) {
+    size_t n = range.size();
+    std::vector<double> xs(n), ys(n);
+    for (size_t k = 0; k < n; ++k) {
+        xs[k] = range(0, k);
+    }
+    f(xs.data(), ys.data(), n);
+    Matrix plot(n, 2);
+    double *out = plot.data();
+    for (size_t k = 0; k < n; ++k) {
+        out[2 * k] = xs[k];
+        out[2 * k + 1] = ys[k];
+    }
+    return plot;
+}
+
+typedef struct Segment {
+    size_t left;    //номер левого конца в points
+    double mid, value, error;
+} Segment;
+
+Matrix Plot::adaptive_sample(double a, double b, const PlotBatch &f) {
+    size_t n0 = std::max<size_t>(2, std::min(min_points, max_points));
+    if (a == b) {
+        n0 = 1;
+    }
+    std::vector<double> xs(n0), ys(n0);
+    for (size_t k = 0; k < n0; ++k) {
+        xs[k] = (n0 == 1) ? a : a + (b - a) * (double) k / (double) (n0 - 1);
+    }
+    f(xs.data(), ys.data(), n0);
+
+    //допуск задается относительно размаха значений, чтобы не зависеть от масштаба функции
+    double lo = INFINITY, hi = -INFINITY;
+    for (double y : ys) {
+        if (std::isfinite(y)) {
+            lo = std::min(lo, y);
+            hi = std::max(hi, y);
+        }
+    }
+    double scale = (hi > lo) ? hi - lo : (std::isfinite(lo) && lo != 0.0 ? std::abs(lo) : 1.0);
+    double limit = tolerance * scale;
+
+    //точки хранятся упорядоченными по x: новые середины вставляются между концами отрезка
+    std::vector<std::pair<double, double>> points(n0);
+    for (size_t k = 0; k < n0; ++k) {
+        points[k] = {xs[k], ys[k]};
+    }
+    std::vector<size_t> active;   //отрезки [points[i], points[i + 1]], которые надо проверить
+    for (size_t k = 0; k + 1 < n0; ++k) {
+        active.push_back(k);
+    }
+
+    std::vector<Segment> segs;
+    while (!active.empty() && points.size() < max_points) {
+        //середины всех проверяемых отрезков считаются одной пачкой
+        size_t m = active.size();
+        xs.resize(m);
+        ys.resize(m);
+        for (size_t k = 0; k < m; ++k) {
+            xs[k] = 0.5 * (points[active[k]].first + points[active[k] + 1].first);
+        }
+        f(xs.data(), ys.data(), m);
+
+        segs.clear();
+        for (size_t k = 0; k < m; ++k) {
+            const auto &l = points[active[k]];
+            const auto &r = points[active[k] + 1];
+            double err = std::abs(ys[k] - 0.5 * (l.second + r.second));
+            if (!std::isfinite(err)) {
+                err = INFINITY;
+            }
+            //отрезок, который уже не делится в double, не уточняется
+            if (err > limit && xs[k] > l.first && xs[k] < r.first) {
+                segs.push_back({active[k], xs[k], ys[k], err});
+            }
+        }
+        //если все середины не помещаются, берутся отрезки с наибольшим отклонением
+        size_t budget = max_points - points.size();
+        if (segs.size() > budget) {
+            std::stable_sort(segs.begin(), segs.end(), [](const Segment &p, const Segment &q) {
+                return p.error > q.error;
+            });
+            segs.resize(budget);
+            std::sort(segs.begin(), segs.end(), [](const Segment &p, const Segment &q) {
+                return p.left < q.left;
+            });
+        }
+
+        //вставка середин за один проход; обе половины каждого разделенного отрезка проверяются снова
+        std::vector<std::pair<double, double>> merged;
+        merged.reserve(points.size() + segs.size());
+        active.clear();
+        size_t s = 0;
+        for (size_t k = 0; k < points.size(); ++k) {
+            merged.push_back(points[k]);
+            if (s < segs.size() && segs[s].left == k) {
+                active.push_back(merged.size() - 1);
+                merged.emplace_back(segs[s].mid, segs[s].value);
+                active.push_back(merged.size() - 1);
+                ++s;
+            }
+        }
+        points.swap(merged);
+    }
+
+    Matrix plot(points.size(), 2);
+    double *out = plot.data();
+    for (size_t k = 0; k < points.size(); ++k) {
+        out[2 * k] = points[k].first;
+        out[2 * k + 1] = points[k].second;
+    }
+    return plot;
+}
+
+// Расстояние от точки p до отрезка [a, b]
+static double distance(double px, double py, double ax, double ay, double bx, double by) {
+    double dx = bx - ax, dy = by - ay;
+    double len2 = dx * dx + dy * dy;
+    double t = (len2 > 0.0) ? ((px - ax) * dx + (py - ay) * dy) / len2 : 0.0;
+    t = std::max(0.0, std::min(1.0, t));
+    return std::hypot(px - (ax + t * dx), py - (ay + t * dy));
+}
+
+Matrix Plot::decimate(const Matrix &points, double tolerance) {
+    size_t n = points.rows();
+    if (n < 3 || !(tolerance > 0.0)) {
+        return points;
+    }
+    std::vector<char> keep(n, 0);
+    //ломаная делится на куски между неконечными точками, каждый кусок прореживается отдельно
+    std::vector<std::pair<size_t, size_t>> stack;
+    size_t begin = 0;
+    for (size_t i = 0; i <= n; ++i) {
+        bool finite = i < n && std::isfinite(points(i, 0)) && std::isfinite(points(i, 1));
+        if (finite) {
+            continue;
+        }
+        if (i < n) {
+            keep[i] = 1;
+        }
+        if (i > begin) {
+            keep[begin] = keep[i - 1] = 1;
+            stack.emplace_back(begin, i - 1);
+        }
+        begin = i + 1;
+    }
+    //стек вместо рекурсии: глубина может доходить до числа точек
+    while (!stack.empty()) {
+        size_t a = stack.back().first, b = stack.back().second;
+        stack.pop_back();
+        if (b <= a + 1) {
+            continue;
+        }
+        double worst = -1.0;
+        size_t far = a;
+        for (size_t i = a + 1; i < b; ++i) {
+            double d = distance(points(i, 0), points(i, 1), points(a, 0), points(a, 1), points(b, 0), points(b, 1));
+            if (d > worst) {
+                worst = d;
+                far = i;
+            }
+        }
+        if (worst > tolerance) {
+            keep[far] = 1;
+            stack.emplace_back(a, far);
+            stack.emplace_back(far, b);
+        }
+    }
+    size_t m = 0;
+    for (char k : keep) {
+        m += k;
+    }
+    Matrix res(m, 2);
+    double *out = res.data();
+    for (size_t i = 0; i < n; ++i) {
+        if (keep[i]) {
+            *out++ = points(i, 0);
+            *out++ = points(i, 1);
+        }
+    }
+    return res;
+}
+
+void Plot::append_points(std::string &out, const Matrix &points) {
+    //на точку: скобки, запятая, перевод строки и два числа, у которых обычно немного цифр до точки
+    out.reserve(out.size() + points.rows() * (16 + 2 * precision));
+    for (size_t i = 0; i < points.rows(); ++i) {
+        out += '(';
+        append_fixed(out, points(i, 0), precision);
+        out += ',';
+        append_fixed(out, points(i, 1), precision);
+        out += ")\n";
+    }
+}
+
+bool Plot::write_table(const std::string &path, const Matrix &points) {
+    std::string text = "x y\n";
+    text.reserve(text.size() + points.rows() * (8 + 2 * precision));
+    for (size_t i = 0; i < points.rows(); ++i) {
+        append_fixed(text, points(i, 0), precision);
+        text += ' ';
+        append_fixed(text, points(i, 1), precision);
+        text += '\n';
+    }
+    std::ofstream out(path, std::ios::binary);
+    out.write(text.data(), (std::streamsize) text.size());
+    return out.good();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "Matrix.h"
+
+
+// Построение точек для \graphic. Функция передается как вычислитель пачки точек:
+// ys[k] = f(xs[k]) для k < n, так вызывающий код сам решает, считать ли пачку параллельно
+typedef std::function<void(const double *xs, double *ys, size_t n)> PlotBatch;
+
+class Plot {
+public:
+    //ключи --adaptive, --plot-tolerance, --plot-min-points, --plot-max-points
+    static bool adaptive;
+    static double tolerance;    //допустимое отклонение от ломаной, в долях размаха значений
+    static size_t min_points;
+    static size_t max_points;
+    static int precision;       //--plot-precision: знаков после точки в координатах
+    static double simplify;     //--plot-simplify: допуск прореживания в единицах графика, 0 - без него
+    static bool data_files;     //--plot-data: точки пишутся в отдельные файлы, а не в текст документа
+
+    // Точки в узлах сетки range (строка 1 x n): матрица n x 2 из пар (x, f(x))
+    static Matrix uniform(const Matrix &range, const PlotBatch &f);
+
+    // Точки на [a, b]: сначала min_points равномерно, затем отрезки, на которых середина
+    // отклоняется от хорды больше допустимого, делятся пополам, пока точек не станет max_points
+    static Matrix adaptive_sample(double a, double b, const PlotBatch &f);
+
+    // Прореживание Рамера-Дугласа-Пекера: остаются точки, без которых ломаная отклонилась бы
+    // больше чем на tolerance. Концы и точки со значениями inf и nan сохраняются всегда
+    static Matrix decimate(const Matrix &points, double tolerance);
+
+    // Дописывает точки n x 2 в out строками (x,y)
+    static void append_points(std::string &out, const Matrix &points);
+
+    // Пишет точки в файл таблицы для pgfplots: строка заголовка "x y", затем по точке на строку.
+    // false, если файл не удалось записать
+    static bool write_table(const std::string &path, const Matrix &points);
+};
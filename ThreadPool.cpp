@@ -0,0 +1,115 @@
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+
+size_t ThreadPool::threads = std::max(1u, std::thread::hardware_concurrency());
+
+thread_local bool ThreadPool::inside = false;
+
+ThreadPool &ThreadPool::instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto &t : workers) {
+        t.join();
+    }
+}
+
+void ThreadPool::start(size_t n) {
+    while (workers.size() < n) {
+        workers.emplace_back(&ThreadPool::worker, this);
+    }
+}
+
+void ThreadPool::run(size_t count_, const std::function<void(size_t)> &job_) {
+    if (threads <= 1 || count_ <= 1 || inside) {
+        for (size_t k = 0; k < count_; ++k) {
+            job_(k);
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+    start(std::min(threads, count_) - 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &job_;
+        count = count_;
+        next = 0;
+        finished = 0;
+        error = nullptr;
+        ++generation;
+    }
+    wake.notify_all();
+
+    inside = true;
+    work();
+    inside = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return finished == count && active == 0; });
+    job = nullptr;
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void ThreadPool::worker() {
+    inside = true;
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&] { return stop || generation != seen; });
+        if (stop) {
+            return;
+        }
+        seen = generation;
+        if (!job || next >= count) {    //пачка уже разобрана
+            continue;
+        }
+        ++active;
+        lock.unlock();
+        work();
+        lock.lock();
+        if (--active == 0 && finished == count) {
+            done.notify_all();
+        }
+    }
+}
+
+// Берет задачи по одной, пока они не кончатся
+void ThreadPool::work() {
+    while (true) {
+        size_t k;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (next >= count) {
+                return;
+            }
+            k = next++;
+        }
+        std::exception_ptr e;
+        try {
+            (*job)(k);
+        } catch (...) {
+            e = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (e && (!error || k < error_index)) {
+            error = e;
+            error_index = k;
+        }
+        if (++finished == count && active == 0) {
+            done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Пул потоков для независимых задач с номерами 0..count-1. Вызывающий поток тоже
+// выполняет задачи и возвращается, когда выполнены все. Если задачи бросили исключения,
+// выбрасывается исключение задачи с наименьшим номером - то же, что при выполнении по порядку.
+// Вложенный run (из задачи пула) выполняется в вызывающем потоке
+class ThreadPool {
+public:
+    static size_t threads;  //число потоков вместе с вызывающим; 1 - без пула
+
+    static ThreadPool &instance();
+
+    void run(size_t count, const std::function<void(size_t)> &job);
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+private:
+    ThreadPool() = default;
+
+    void start(size_t n);
+
+    void worker();
+
+    void work();
+
+    std::vector<std::thread> workers;
+    std::mutex run_mutex;           //одна пачка задач за раз
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(size_t)> *job = nullptr;
+    size_t count = 0;
+    size_t next = 0;
+    size_t finished = 0;
+    size_t active = 0;              //потоки, которые сейчас берут задачи текущей пачки
+    size_t generation = 0;
+    bool stop = false;
+
+    std::exception_ptr error;
+    size_t error_index = 0;
+
+    static thread_local bool inside;
+};
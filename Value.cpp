@@ -4,16 +4,21 @@
 #include <utility>
 
 #include "Value.h"
+#include "CallFrame.h"
 #include "basic_HM.h"
+#include "ThreadPool.h"
+#include "Plot.h"
+#include "BatchExpr.h"
+#include "Numeric.h"
 
 
-Func::Func(const Func &f) : argv(f.argv) {
-    local = f.local;
-    body = new Node(*f.body);
-}
+Func::Func(const Func &f) : name(f.name), argv(f.argv), local(f.local), body(f.body), refs(1) {}
+
+Func::Func(Func &&f) noexcept :
+name(std::move(f.name)), argv(std::move(f.argv)), local(std::move(f.local)), body(std::move(f.body)), refs(1) {}
 
-Func::Func(std::vector<std::string> as, name_table nt, Node *b) :
-argv(std::move(as)), local(std::move(nt)), body(b) {}
+Func::Func(std::string n, std::vector<std::string> as, name_table nt, std::shared_ptr<const Node> b) :
+name(std::move(n)), argv(std::move(as)), local(std::move(nt)), body(std::move(b)), refs(1) {}
 
 
 Value::BadType::BadType(Type actual, Type expected) {
@@ -25,88 +30,289 @@ const char* Value::BadType::what() {
     return msg.c_str();
 }
 
-Value::Value() : _type(UNDEFINED) {}
+// Аргументы кладутся в слоты нового кадра, а не в таблицу Func: вызовы не пересекаются
+// по данным, и рекурсия не затирает аргументы вызывающего
+Value Value::call(const Value &arg, std::vector<Value> arguments, const Coordinate& pos) {
+    const Func *f = arg.get_function();
+    if (arguments.size() != f->argv.size()) {
+        throw Error(pos, "Wrong argument number");
+    }
+    Memo::Key key;
+    Value res;
+    if (f->memo.find(f, arguments, key, res)) {
+        return res;
+    }
+    CallStack depth(pos);
+    Frame frame(f, arguments);
+    res = CallStack::exec(f->body, &frame);
+    if (!key.empty()) {
+        f->memo.store(std::move(key), res);
+    }
+    return res;
+}
+
+// f(x) в точках пачки для \integral и \findroot; аргумент имеет размерность xdim.
+// Первый вызов в точке probe - обычный: он проверяет типы и дает значение y0 и размерность ydim.
+// Арифметическое тело чистой функции дальше считается через BatchExpr, остальные - вызовами
+// с проверкой, что значение осталось числом той же размерности
+static PlotBatch point_batch(const Value &func_v, Dimension xdim, double probe,
+                             double &y0, Dimension &ydim, const Coordinate &pos) {
+    if (func_v.type() != Value::FUNCTION || func_v.get_function()->argv.size() != 1) {
+        throw Error(pos, "Function of one argument expected");
+    }
+    const Func *f = func_v.get_function();
+    Value y = Value::call(func_v, {Value(probe, xdim)}, pos);
+    if (y.type() != Value::DOUBLE && y.type() != Value::INFERRED_DOUBLE) {
+        throw Error(pos, "Function must return a number");
+    }
+    y0 = y.get_double();
+    ydim = y.dimension();
+    std::shared_ptr<BatchExpr> vec;
+    if (Node::is_pure(f)) {
+        vec = BatchExpr::compile(f, 0, {Value(probe, xdim)});
+    }
+    return [func_v, xdim, ydim, vec, &pos](const double *xs, double *ys, size_t n) {
+        if (vec && vec->eval(xs, ys, n)) {
+            return;
+        }
+        for (size_t k = 0; k < n; ++k) {
+            Value v = Value::call(func_v, {Value(xs[k], xdim)}, pos);
+            if ((v.type() != Value::DOUBLE && v.type() != Value::INFERRED_DOUBLE) || v.dimension() != ydim) {
+                throw Error(pos, "Function value changes type or dimension");
+            }
+            ys[k] = v.get_double();
+        }
+    };
+}
+
+// Границы - числа одной размерности
+static Dimension bounds(const Value &a, const Value &b, const Coordinate &pos) {
+    for (const Value *v : {&a, &b}) {
+        if ((v->type() != Value::DOUBLE && v->type() != Value::INFERRED_DOUBLE) || !std::isfinite(v->get_double())) {
+            throw Error(pos, "Bounds must be finite numbers");
+        }
+    }
+    if (a.dimension() != b.dimension()) {
+        throw Error(pos, "Bounds must have the same dimension");
+    }
+    return a.dimension();
+}
+
+Value Value::integral(const Value &func, const Value &a, const Value &b, const Coordinate& pos) {
+    Dimension xdim = bounds(a, b, pos);
+    double x0 = a.get_double(), x1 = b.get_double();
+    double y0, res;
+    Dimension ydim;
+    //середина, а не конец: на концах у сходящихся интегралов бывают особенности
+    PlotBatch f = point_batch(func, xdim, 0.5 * (x0 + x1), y0, ydim, pos);
+    if (!Numeric::integrate(x0, x1, f, res)) {
+        throw Error(pos, "Integral does not converge");
+    }
+    if (!std::isfinite(res)) {
+        throw Error(pos, "Integral is not finite");
+    }
+    return {res, sum_dimensions(ydim, xdim, pos)};
+}
+
+Value Value::findroot(const Value &func, const Value &a, const Value &b, const Coordinate& pos) {
+    Dimension xdim = bounds(a, b, pos);
+    double x0 = a.get_double(), x1 = b.get_double();
+    double y0, y1, res;
+    Dimension ydim;
+    PlotBatch f = point_batch(func, xdim, x0, y0, ydim, pos);
+    f(&x1, &y1, 1);
+    if (y0 == 0.0) {
+        return {x0, xdim};
+    }
+    if (y1 == 0.0) {
+        return {x1, xdim};
+    }
+    if (!((y0 < 0.0 && y1 > 0.0) || (y0 > 0.0 && y1 < 0.0))) {
+        throw Error(pos, "Function values at the bounds must have different signs");
+    }
+    if (!Numeric::find_root(x0, x1, y0, y1, f, res)) {
+        throw Error(pos, "Root is not found");
+    }
+    return {res, xdim};
+}
 
-Value::Value(std::array<int, 7> dim) : _type(DOUBLE) {
+Value Value::odesolve(const Value &func, const Value &init, const Value &t0, const Value &t1,
+                      const Coordinate& pos) {
+    Dimension tdim = bounds(t0, t1, pos);
+    if (func.type() != FUNCTION) {
+        throw Error(pos, "Function expected");
+    }
+    size_t argc = func.get_function()->argv.size();
+    if (argc != 1 && argc != 2) {
+        throw Error(pos, "Derivative must be a function of (t, y) or of (y)");
+    }
+    bool vector = init.type() == MATRIX || init.type() == INFERRED_MATRIX;
+    size_t rows = 1, cols = 1;
+    std::vector<double> y0;
+    if (vector) {
+        const Matrix &m = init.get_matrix();
+        if ((m.rows() != 1 && m.cols() != 1) || m.size() == 0) {
+            throw Error(pos, "Initial state must be a number or a vector");
+        }
+        rows = m.rows();
+        cols = m.cols();
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                y0.push_back(m(i, j));
+            }
+        }
+    } else if (init.type() == DOUBLE || init.type() == INFERRED_DOUBLE) {
+        y0.push_back(init.get_double());
+    } else {
+        throw Error(pos, "Initial state must be a number or a vector");
+    }
+    size_t n = y0.size();
+    Dimension ydim = init.dimension(), ddim = sub_dimensions(ydim, tdim, pos);
+
+    //состояние передается в функцию той же формы, что y0; производная - число или вектор
+    //из n элементов размерности [y] / [t] (нулевая производная может быть без размерности)
+    std::vector<Value> args(argc);
+    OdeRhs rhs = [&](double t, const double *y, double *dy) {
+        Value state = vector ? Value(Matrix(rows, cols, std::vector<double>(y, y + n)), ydim) : Value(y[0], ydim);
+        if (argc == 2) {
+            args[0] = Value(t, tdim);
+        }
+        args[argc - 1] = std::move(state);
+        Value d = Value::call(func, args, pos);
+        bool zero = true;
+        if (d.type() == MATRIX || d.type() == INFERRED_MATRIX) {
+            const Matrix &m = d.get_matrix();
+            if (!vector || (m.rows() != 1 && m.cols() != 1) || m.size() != n) {
+                throw Error(pos, "Derivative must have the shape of the state");
+            }
+            for (size_t i = 0; i < m.rows(); ++i) {
+                for (size_t j = 0; j < m.cols(); ++j) {
+                    double v = m(i, j);
+                    dy[i * m.cols() + j] = v;
+                    zero = zero && v == 0.0;
+                }
+            }
+        } else if ((d.type() == DOUBLE || d.type() == INFERRED_DOUBLE) && !vector) {
+            dy[0] = d.get_double();
+            zero = dy[0] == 0.0;
+        } else {
+            throw Error(pos, "Derivative must have the shape of the state");
+        }
+        if (!zero && d.dimension() != ddim) {
+            throw Error(pos, "Derivative must have the dimension of state / time");
+        }
+    };
+    std::vector<double> out;
+    if (!Numeric::ode_solve(t0.get_double(), t1.get_double(), y0, rhs, out)) {
+        throw Error(pos, "ODE solution failed: step limit reached or step too small");
+    }
+    size_t w = n + 1;
+    size_t count = out.size() / w;
+    return {Matrix(count, w, std::move(out))};
+}
+
+// Счетчик ссылок Func
+template <typename T>
+static T *retain(T *p) {
+    p->refs.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+template <typename T>
+static void release(T *p) {
+    if (p->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete p;
+    }
+}
+
+Value::Value() : _meta(pack(UNDEFINED, dimensionless)) {}
+
+Value::Value(Dimension dim) : _meta(pack(DOUBLE, dim)) {
     _double_data = 1.0;
-    _dimension = dim;
 }
 
-Value::Value(double d) : _type(DOUBLE) {
+Value::Value(double d) : _meta(pack(DOUBLE, dimensionless)) {
     _double_data = d;
 }
 
-Value::Value(double d, std::array<int, 7> dim) : _type(DOUBLE) {
+Value::Value(double d, Dimension dim) : _meta(pack(DOUBLE, dim)) {
     _double_data = d;
-    _dimension = dim;
 }
 
-Value::Value(Matrix m) : _type(MATRIX) {
-    _matrix_data = new Matrix(m.size());
-    for (size_t i = 0; i < m.size(); ++i) {
-        for (size_t j = 0; j < m[i].size(); ++j) {
-            (*_matrix_data)[i].push_back(Value(m[i][j]));
-        }
+Value::Value(Matrix m) : _meta(pack(MATRIX, dimensionless)) {
+    _matrix_data = new Matrix(std::move(m));
+}
+
+Value::Value(Matrix m, Dimension dim) : _meta(pack(MATRIX, dim)) {
+    _matrix_data = new Matrix(std::move(m));
+}
+
+Value::Value(Func *f) : _meta(pack(FUNCTION, dimensionless)) {
+    _function_data = f;
+}
+
+Value::Value(const Value &other) : _meta(other._meta) {
+    Type t = type();
+    if (t == DOUBLE || t == INFERRED_DOUBLE) {
+        _double_data = other._double_data;
+    } else if (t == MATRIX || t == INFERRED_MATRIX) {
+        _matrix_data = new Matrix(*other._matrix_data);
+    } else if (t == FUNCTION) {
+        _function_data = retain(other._function_data);
     }
 }
 
-Value::Value(Matrix m, std::array<int, 7> dim) : _type(MATRIX) {
-    _dimension = dim;
-    _matrix_data = new Matrix(m.size());
-    for (size_t i = 0; i < m.size(); ++i) {
-        for (size_t j = 0; j < m[i].size(); ++j) {
-            (*_matrix_data)[i].push_back(Value(m[i][j]));
-        }
+// Перемещение забирает данные other; other остается UNDEFINED и ничего не освобождает
+Value::Value(Value &&other) noexcept : _meta(other._meta) {
+    Type t = type();
+    if (t == DOUBLE || t == INFERRED_DOUBLE) {
+        _double_data = other._double_data;
+    } else if (t == MATRIX || t == INFERRED_MATRIX) {
+        _matrix_data = other._matrix_data;
+    } else if (t == FUNCTION) {
+        _function_data = other._function_data;
     }
+    other._meta = pack(UNDEFINED, dimensionless);
 }
 
-Value::Value(Func *f) : _type(FUNCTION) {
-    _function_data = new Func(*f);
+void Value::release_data() {
+    Type t = type();
+    if (t == MATRIX || t == INFERRED_MATRIX) {
+        delete _matrix_data;
+    } else if (t == FUNCTION) {
+        release(_function_data);
+    }
 }
 
-Value::Value(const Value &other) : _type(other._type) {
-    if (_type == DOUBLE || _type == INFERRED_DOUBLE) {
-        _double_data = other._double_data;
-        _dimension = other._dimension;
-    } else if (_type == MATRIX || _type == INFERRED_MATRIX) {
-        _dimension = other._dimension;
-        _matrix_data = new Matrix(other._matrix_data->size());
-        for (size_t i = 0; i < _matrix_data->size(); ++i) {
-            for (size_t j = 0; j < (*other._matrix_data)[i].size(); ++j) {
-                (*_matrix_data)[i].push_back(Value((*other._matrix_data)[i][j]));
-            }
+Value& Value::operator=(Value &&other) noexcept {
+    if (&other != this) {
+        release_data();
+        _meta = other._meta;
+        Type t = type();
+        if (t == DOUBLE || t == INFERRED_DOUBLE) {
+            _double_data = other._double_data;
+        } else if (t == MATRIX || t == INFERRED_MATRIX) {
+            _matrix_data = other._matrix_data;
+        } else if (t == FUNCTION) {
+            _function_data = other._function_data;
         }
-    } else if (_type == FUNCTION) {
-        _function_data = new Func(*other._function_data);
+        other._meta = pack(UNDEFINED, dimensionless);
     }
+    return *this;
 }
 
 Value& Value::operator=(const Value &other) {
 
     if (&other != this) {
-        if (_type == DOUBLE || _type == INFERRED_DOUBLE) {
-            _double_data = 0.0;
-            _dimension.fill(0);
-        } else if (_type == MATRIX || _type == INFERRED_MATRIX) {
-            delete _matrix_data;
-            _dimension.fill(0);
-        } else if (_type == FUNCTION) {
-            delete _function_data;
-        }
-        _type = other._type;
-        if (_type == DOUBLE || _type == INFERRED_DOUBLE) {
-            _dimension = other._dimension;
+        release_data();
+        _meta = other._meta;
+        Type t = type();
+        if (t == DOUBLE || t == INFERRED_DOUBLE) {
             _double_data = other._double_data;
-        } else if (_type == MATRIX || _type == INFERRED_MATRIX) {
-            _dimension = other._dimension;
-            _matrix_data = new Matrix(other._matrix_data->size());
-            for (size_t i = 0; i < _matrix_data->size(); ++i) {
-                for (size_t j = 0; j < (*other._matrix_data)[i].size(); ++j) {
-                    (*_matrix_data)[i].push_back(Value((*other._matrix_data)[i][j]));
-                }
-            }
-        } else if (_type == FUNCTION) {
-            _function_data = new Func(*other._function_data);
+        } else if (t == MATRIX || t == INFERRED_MATRIX) {
+            _matrix_data = new Matrix(*other._matrix_data);
+        } else if (t == FUNCTION) {
+            _function_data = retain(other._function_data);
         }
     }
 
@@ -114,40 +320,48 @@ Value& Value::operator=(const Value &other) {
 }
 
 Value::~Value() {
-    if (_type == MATRIX || _type == INFERRED_MATRIX) delete _matrix_data;
-    if (_type == FUNCTION) delete _function_data;
+    release_data();
 }
 
 // Функции ниже в зависимости от типа возвращают значение или бросают исключение
 
 double Value::get_double() const {
-    if (_type != DOUBLE && _type != INFERRED_DOUBLE) {
+    if (type() != DOUBLE && type() != INFERRED_DOUBLE) {
         std::cout << "error in get_double()\n";
-        throw BadType(_type, DOUBLE);
+        throw BadType(type(), DOUBLE);
     }
     return _double_data;
 }
 
-std::array<int, 7> Value::get_dimension() const {
-    if (_type != DOUBLE && _type != INFERRED_DOUBLE) {
+Dimension Value::get_dimension() const {
+    if (type() != DOUBLE && type() != INFERRED_DOUBLE && type() != MATRIX && type() != INFERRED_MATRIX) {
         std::cout << "error in get_double()\n";
-        throw BadType(_type, DOUBLE);
+        throw BadType(type(), DOUBLE);
     }
-    return _dimension;
+    return dimension();
 }
 
-Matrix& Value::get_matrix() const {
-    if (_type != MATRIX && _type != INFERRED_MATRIX) {
+const Matrix& Value::get_matrix() const {
+    if (type() != MATRIX && type() != INFERRED_MATRIX) {
         std::cout << "error in get_matrix()\n";
-        throw BadType(_type, MATRIX);
+        throw BadType(type(), MATRIX);
+    }
+    return *_matrix_data;
+}
+
+// Доступ на запись: буфер, разделяемый с другими значениями, копирует сама Matrix перед первой записью
+Matrix& Value::edit_matrix() {
+    if (type() != MATRIX && type() != INFERRED_MATRIX) {
+        std::cout << "error in edit_matrix()\n";
+        throw BadType(type(), MATRIX);
     }
     return *_matrix_data;
 }
 
 Func* Value::get_function() const {
-    if (_type != FUNCTION) {
+    if (type() != FUNCTION) {
         std::cout << "error in get_function()\n";
-        throw BadType(_type, FUNCTION);
+        throw BadType(type(), FUNCTION);
     }
     return _function_data;
 }
@@ -156,8 +370,8 @@ Func* Value::get_function() const {
 Replacement::Replacement() :
 tag(PLACEHOLDER), begin(0), end(0), replacement(Value(0.0, Value::dimensionless)) {}
 
-Replacement::Replacement(Tag t, size_t b, size_t e, const Value& v) :
-tag(t), begin(b), end(e), replacement(v) {}
+Replacement::Replacement(Tag t, size_t b, size_t e, Value v) :
+tag(t), begin(b), end(e), replacement(std::move(v)) {}
 
 
 Node::Node(Token *t) {
@@ -183,12 +397,25 @@ void Node::copy_defs(name_table &local, name_table *ptr) {
     else local.insert(global.begin(), global.end());
 }
 
-Value &Node::lookup(const std::string& name, name_table *ptr, const Coordinate& pos) {
-    if (ptr) {
-        auto res = ptr->find(name);
-        if (res != ptr->end()) {
+// Порядок поиска внутри функции: аргумент (по номеру слота), локальные имена вызова,
+// имя самой функции, замыкание, затем global
+Value &Node::lookup(const std::string& name, Frame *frame, const Coordinate& pos, int slot) {
+    if (frame) {
+        if (slot >= 0) {
+            return frame->slots[slot];
+        }
+        auto res = frame->locals.find(name);
+        if (res != frame->locals.end()) {
             return res->second;
         }
+        if (name == frame->func->name) {
+            return frame->self();
+        }
+        auto cap = frame->func->local.find(name);
+        if (cap != frame->func->local.end()) {
+            //замыкание общее для всех вызовов; изменять его можно только через lookup_for_write
+            return const_cast<Value &>(cap->second);
+        }
     }
     auto res = global.find(name);
     if (res != global.end()) {
@@ -197,16 +424,39 @@ Value &Node::lookup(const std::string& name, name_table *ptr, const Coordinate&
     throw Error(pos, "Undefined variable reference");
 }
 
-void Node::def(const std::string& name, const Value& val, name_table *ptr) {
+// То же, что lookup, но захваченное значение перед изменением копируется в кадр вызова
+Value &Node::lookup_for_write(const std::string& name, Frame *frame, const Coordinate& pos, int slot) {
+    if (frame && slot < 0 && frame->locals.find(name) == frame->locals.end()) {
+        auto cap = frame->func->local.find(name);
+        if (cap != frame->func->local.end()) {
+            return frame->locals.emplace(name, cap->second).first->second;
+        }
+    }
+    Value &res = lookup(name, frame, pos, slot);
+    if (Memo::tracking.load(std::memory_order_acquire)) {
+        auto it = global.find(name);
+        if (it != global.end() && &it->second == &res) {
+            Memo::changed(name);   //global изменится
+        }
+    }
+    return res;
+}
+
+void Node::def(const std::string& name, Value val, Frame *frame, int slot) {
 //    std::cout << "def is invoked for name = " << name << "\n";
-    if (ptr) {
+    if (frame) {
         auto res = global.find(name);
         if (res == global.end()) {
-            (*ptr)[name] = val;
+            if (slot >= 0) {
+                frame->slots[slot] = std::move(val);
+            } else {
+                frame->locals[name] = std::move(val);
+            }
             return;
         }
     }
-    global[name] = val;
+    global[name] = std::move(val);
+    Memo::changed(name);
 }
 
 // Семантический анализ (проверка размерностей)
@@ -220,72 +470,108 @@ void Node::semantic_analysis() {
     }
 }
 
-Value Node::exec(name_table *scope = nullptr) {
+// Число точек \graphic в одной задаче пула: при вызовах функции по точкам и при вычислении пачкой
+static const size_t graphic_chunk = 64;
+static const size_t batch_chunk = 4096;
+
+// Индексы x_i, x_{i,j}, x_{i,*}, x_{*,j}. Вычисляются до обращения к матрице:
+// вычисление индекса может изменить таблицу имен. Вместо * возвращается slice_all
+static const long slice_all = -1;
+
+long Node::index_value(const Node *n, Frame *scope, const Coordinate &pos) {
+    if (n->_tag == SLICE) {
+        return slice_all;
+    }
+    int k = (int) n->exec(scope).get_double();
+    if (k < 0) {
+        throw Error(pos, "Negative index");
+    }
+    return k;
+}
+
+void Node::eval_index(const std::vector<Node *> &idx, Frame *scope, const Coordinate &pos, long &i, long &j) {
+    i = index_value(idx[0], scope, pos);
+    j = (idx.size() == 2) ? index_value(idx[1], scope, pos) : 0;
+}
+
+typedef enum Access {
+    ELEMENT, ROW, COLUMN
+} Access;
+
+// Строка и столбец элемента в матрице ver x hor; у вектора один индекс
+static Access resolve_index(size_t count, long i, long j, size_t ver, size_t hor, const Coordinate &pos,
+                            const char *vector_error, size_t &ri, size_t &rj) {
+    if (count == 1) {
+        if (i == slice_all) {
+            throw Error(pos, "Bad index");
+        }
+        if (ver == 1) {
+            j = i;
+            i = 0;
+        } else if (hor != 1) {
+            throw Error(pos, vector_error);
+        }
+    }
+    if (i == slice_all && j == slice_all) {
+        throw Error(pos, "Bad index");
+    }
+    if ((i != slice_all && (size_t) i >= ver) || (j != slice_all && (size_t) j >= hor)) {
+        throw Error(pos, "Index is out of range");
+    }
+    ri = (i == slice_all) ? 0 : i;
+    rj = (j == slice_all) ? 0 : j;
+    if (i == slice_all) return COLUMN;
+    if (j == slice_all) return ROW;
+    return ELEMENT;
+}
+
+Value Node::exec(Frame *scope = nullptr) const {
     if (_tag == NUMBER) {   //если это NUMBER, то в _label записана строка с числом
         double val = std::stod(this->_label);
         return {val, Value::dimensionless};
     }
     else if (_tag == BEGINM) {  //это матрица, нужно собрать из полей Matrix
-        Matrix m;   //при построении проверяется, что матрица прямоугольная и как минимум 1 х 1, поэтому здесь проверки не нужны
-        for (auto & field : fields) {   //цикл по строкам
-            std::vector<Value> v;
-            for (auto & jt : field->fields) { //цикл по элементам строк
-                v.push_back(jt->exec(scope));
+        //при построении проверяется, что матрица прямоугольная и как минимум 1 х 1, поэтому здесь проверки не нужны
+        Value res(Matrix(fields.size(), fields[0]->fields.size()), Value::dimensionless);
+        for (size_t i = 0; i < fields.size(); ++i) {   //цикл по строкам
+            const auto &row = fields[i]->fields;
+            for (size_t j = 0; j < row.size(); ++j) { //цикл по элементам строк
+                Value::set_element(res, i, j, row[j]->exec(scope), row[j]->_coord);
             }
-            m.push_back(v);
         }
-        return {m};
+        return res;
     }
     else if (_tag == IDENT) {   //переменная
-        Value x_val = Node::lookup(_label, scope, _coord);
-        size_t sz = fields.size();
-        if (sz == 0) {  //обычная переменная
-            return x_val;
-        } else {
-            Matrix *m = &x_val.get_matrix();
-            size_t ver = (*m).size();
-            size_t hor = (*m)[0].size();
-
-            int int_i = (int) fields[0]->exec(scope).get_double();
-            if (int_i < 0) {
-                throw Error(left->_coord, "Negative index");
-            }
-            size_t i = int_i;
-            size_t j = 0;
-
-
-            if (sz == 1) { //элемент вектора
-                if (ver == 1) {
-                    j = i;
-                    i = 0;
-                } else if (hor != 1) {
-                    throw Error(_coord, "Can't use vector index for matrix");
-                }
-            } else if (sz == 2) { //элемент матрицы
-                int int_j = (int) fields[1]->exec(scope).get_double();
-                if (int_j < 0) {
-                    throw Error(left->_coord, "Negative index");
-                }
-                j = int_j;
-            }
-            if (i >= ver || j >= hor) {
-                throw Error(_coord, "Index is out of range");
-            }
-            return (*m)[i][j];
+        if (fields.empty()) {  //обычная переменная
+            return Node::lookup(_label, scope, _coord, _slot);
         }
-
+        //элемент или срез читается прямо из хранимой матрицы, без копирования
+        long i, j;
+        eval_index(fields, scope, _coord, i, j);
+        const Value &x_val = Node::lookup(_label, scope, _coord, _slot);
+        const Matrix &m = x_val.get_matrix();
+        size_t ri, rj;
+        Access access = resolve_index(fields.size(), i, j, m.rows(), m.cols(), _coord,
+                                      "Can't use vector index for matrix", ri, rj);
+        if (access == ROW) {
+            return Value::slice(x_val, true, ri);
+        } else if (access == COLUMN) {
+            return Value::slice(x_val, false, rj);
+        }
+        return Value::element(x_val, ri, rj);
     }
     else if (_tag == FUNC) {  //вызов функции
         //область видимости переменных -- функция
-        Value f_val = Node::lookup(_label, scope, _coord);
-        Func *f = f_val.get_function();
+        //копия значения-функции только увеличивает счетчик ссылок и держит Func живым,
+        //даже если тело или аргументы переопределят это имя
+        Value f_val = Node::lookup(_label, scope, _coord, _slot);
         //загрузка значений имен переменных
         size_t f_s = fields.size();
         std::vector<Value> args;
         for (size_t i = 0; i < f_s; ++i) {
             args.push_back(fields[i]->exec(scope));
         }
-        return Value::call(f_val, args, _coord);
+        return Value::call(f_val, std::move(args), _coord);
     }
     else if (_tag == UADD || _tag == LPAREN) {
         return right->exec(scope);
@@ -300,38 +586,25 @@ Value Node::exec(name_table *scope = nullptr) {
         if (left->_tag == IDENT) {
             size_t sz = left->fields.size();
             if (sz == 0) {    //переменная
-                Node::def(left->_label, right->exec(scope), scope);
+                Node::def(left->_label, right->exec(scope), scope, left->_slot);
             } else {    //матрица
-                Value *m_val = &Node::lookup(left->_label, scope, left->_coord);
-                Matrix *m = &m_val->get_matrix();
-                size_t ver = (*m).size();
-                size_t hor = (*m)[0].size();
-                int int_i = (int) left->fields[0]->exec(scope).get_double();
-                if (int_i < 0) {
-                    throw Error(left->_coord, "Negative index");
-                }
-                size_t i = int_i;
-                size_t j = 0;
-                if (sz == 1) { //элемент вектора
-                    if (ver == 1) {
-                        j = i;
-                        i = 0;
-                    } else if (hor != 1) {
-                        throw Error(_coord, "Bad index");
-                    }
-                } else if (sz == 2) { //элемент матрицы
-                    int int_j = (int) left->fields[1]->exec(scope).get_double();
-                    if (int_j < 0) {
-                        throw Error(left->_coord, "Negative index");
-                    }
-                    j = int_j;
-                } else {
+                if (sz > 2) {
                     throw Error(_coord, "Bad index");
                 }
-                if (i >= ver || j >= hor) {
-                    throw Error(_coord, "Index is out of range");
+                long i, j;
+                eval_index(left->fields, scope, left->_coord, i, j);
+                Value val = right->exec(scope);
+                Value &m_val = Node::lookup_for_write(left->_label, scope, left->_coord, left->_slot);
+                const Matrix &m = m_val.get_matrix();
+                size_t ri, rj;
+                Access access = resolve_index(sz, i, j, m.rows(), m.cols(), _coord, "Bad index", ri, rj);
+                if (access == ROW) {
+                    Value::set_slice(m_val, true, ri, val, _coord);
+                } else if (access == COLUMN) {
+                    Value::set_slice(m_val, false, rj, val, _coord);
+                } else {
+                    Value::set_element(m_val, ri, rj, val, _coord);
                 }
-                (*m)[i][j] = right->exec(scope);
                 return {0.0, Value::dimensionless};
             }
         }
@@ -342,12 +615,27 @@ Value Node::exec(name_table *scope = nullptr) {
             for (auto it = left->fields.begin(); it < left->fields.end(); ++it) {
                 ns.push_back((*it)->_label);
             }
-            //если функция объявляется глобально, ссылаться на Node из дерева нельзя
-            //т.к. для каждого блока preproc строится новое, а старое удаляется
-            Node *copy_of_right = new Node(*right);
-            Func *f = (scope) ? new Func(ns, *scope, copy_of_right) : new Func(ns, global, copy_of_right);
-            Value func_v = Value(f);
-            Node::def(left->_label, func_v, scope);
+            //для каждого блока preproc строится новое дерево, а старое удаляется; тело
+            //имеет свой счетчик ссылок (см. Node::optimize) и переживает дерево без копирования
+            std::shared_ptr<const Node> body = _body ? _body : std::make_shared<const Node>(*right);
+            //замыкание получает только те имена, на которые ссылается тело (см. Node::optimize),
+            //по значению на момент объявления: из кадра вызова, а если там имени нет - из global.
+            //Имена, которых при объявлении еще нет, при вызове ищутся в global
+            name_table captured;
+            for (auto & name : _captures) {
+                const Value *v = scope ? scope->find(name) : nullptr;
+                if (!v) {
+                    auto it = global.find(name);
+                    if (it != global.end()) {
+                        v = &it->second;
+                    }
+                }
+                if (v) {
+                    captured.emplace_hint(captured.end(), name, *v);
+                }
+            }
+            Func *f = new Func(left->_label, std::move(ns), std::move(captured), std::move(body));
+            Node::def(left->_label, Value(f), scope, left->_slot);
         } else {
             throw Error(_coord, "Can't define this");
         }
@@ -373,11 +661,11 @@ Value Node::exec(name_table *scope = nullptr) {
     else if (_tag == EQ) {
         Value res = left->exec(scope);
         if (right->_tag == PLACEHOLDER) {
-            reps[right->_coord].replacement = res;
+            reps[right->_coord].replacement = std::move(res);
             return {1.0, Value::dimensionless}; //равенство выполняется, вернуть 1 - нормально
         } else if (right->left != nullptr && right->left->_tag == PLACEHOLDER) {
             Value r = Value::div(res, right->right->exec(scope), _coord);
-            reps[right->_coord].replacement = r;
+            reps[right->_coord].replacement = std::move(r);
             return {1.0, Value::dimensionless}; //равенство выполняется, вернуть 1 - нормально
         }
         return Value::eq(res, right->exec(scope), _coord);
@@ -437,16 +725,16 @@ Value Node::exec(name_table *scope = nullptr) {
             return left->exec(scope);
         }
     }
-    else if (_tag == WHILE) {
-        Value res(0.0);
-        while (cond->exec(scope).get_double() == 1.0) {
-            res = right->exec(scope);
-        }
-        return res;
-    }
-    else if (_tag == PRODUCT) {
+    else if (_tag == WHILE || _tag == PRODUCT) {
         Value res(0.0);
+        bool hoisted = fields.empty();
         while (cond->exec(scope).get_double() == 1.0) {
+            if (!hoisted) { //вынесенные из тела инварианты считаются один раз, перед первой итерацией
+                for (auto & field : fields) {
+                    field->exec(scope);
+                }
+                hoisted = true;
+            }
             res = right->exec(scope);
         }
         return res;
@@ -455,22 +743,44 @@ Value Node::exec(name_table *scope = nullptr) {
         return Value::transpose(left->exec(scope));
     }
     else if (_tag == RANGE) {
-        std::vector<Value> row;
+        std::vector<double> row;
         double a = left->exec(scope).get_double();
         double b = right->exec(scope).get_double();
         double d = (cond) ? Value(cond->exec(scope)).get_double() : 0.1;
         for (double x = a; x <= b; x += d) {
-            row.emplace_back(x);
+            row.push_back(x);
         }
         if (row.empty()) {
             throw Error(_coord, "Empty range");
         }
-        Matrix m;
-        m.push_back(row);
-        return {m};
+        size_t n = row.size();
+        return {Matrix(1, n, std::move(row))};
     }
     else if (_tag == GRAPHIC) {
-        Value func_v = Node::lookup(_label, scope, _coord);
+        Value func_v = Node::lookup(_label, scope, _coord, _slot);
+        if (func_v.type() == Value::MATRIX || func_v.type() == Value::INFERRED_MATRIX) {
+            //готовые точки, например траектория \odesolve: столбец 0 - x, столбец из параметра
+            //(по умолчанию 1) - y
+            const Matrix &m = func_v.get_matrix();
+            if (fields.size() > 1) {
+                throw Error(_coord, "Expected column number");
+            }
+            long col = fields.empty() ? 1 : index_value(fields[0], scope, _coord);
+            if (m.size() == 0 || col < 1 || (size_t) col >= m.cols()) {
+                throw Error(_coord, "Bad column for graphic");
+            }
+            Matrix plot(m.rows(), 2);
+            double *out = plot.data();
+            for (size_t k = 0; k < m.rows(); ++k) {
+                out[2 * k] = m(k, 0);
+                out[2 * k + 1] = m(k, col);
+            }
+            if (Plot::simplify > 0.0) {
+                plot = Plot::decimate(plot, Plot::simplify);
+            }
+            Node::reps[_coord].replacement = Value(std::move(plot));
+            return {0.0, Value::dimensionless};
+        }
         Func *func = func_v.get_function();
         size_t sz = func->argv.size();
         std::vector<Value> args(sz);
@@ -492,17 +802,58 @@ Value Node::exec(name_table *scope = nullptr) {
             throw Error(_coord, "No range parameter");
         }
         Value range_v = fields[ivar]->exec(scope);
-        Matrix *range = &range_v.get_matrix();
-
-        Matrix plot;
-        for (auto & it : (*range)[0]) {
-            args[ivar] = it;
-            double fx = Value::call(func, args, _coord).get_double();
-            std::vector<Value> point = {it, Value(fx)};
-            plot.push_back(point);
+        const Matrix &range = range_v.get_matrix();
+
+        //точки пачки разбиваются на куски; если функция не меняет общего состояния, куски
+        //считаются в пуле потоков. Каждый кусок пишет только свои значения,
+        //поэтому порядок точек тот же, что при вычислении подряд
+        bool pure = Node::is_pure(func);
+        //арифметическое тело считается сразу над всей пачкой; первая точка диапазона один раз,
+        //до построения точек, вычисляется обычным вызовом, чтобы проверить типы и размерности
+        //с теми же ошибками (от значения аргумента они не зависят)
+        std::unique_ptr<BatchExpr> vec = pure ? BatchExpr::compile(func, ivar, args) : nullptr;
+        if (vec) {
+            args[ivar] = Value(range(0, 0));
+            Value::call(func_v, args, _coord).get_double();
         }
-        Value graphic(plot);
-        Node::reps[_coord].replacement = graphic;
+        auto batch = [&](const double *xs, double *ys, size_t n) {
+            if (vec && n > 1) {
+                size_t parts = (n + batch_chunk - 1) / batch_chunk;
+                std::atomic<bool> ok(true);
+                ThreadPool::instance().run(parts, [&](size_t c) {
+                    size_t begin = c * batch_chunk;
+                    if (!vec->eval(xs + begin, ys + begin, std::min(n - begin, batch_chunk))) {
+                        ok = false;
+                    }
+                });
+                if (ok) {
+                    return;
+                }
+            }
+            size_t chunks = (n + graphic_chunk - 1) / graphic_chunk;
+            auto sample = [&](size_t c) {
+                std::vector<Value> a = args;
+                size_t end = std::min(n, (c + 1) * graphic_chunk);
+                for (size_t k = c * graphic_chunk; k < end; ++k) {
+                    a[ivar] = Value(xs[k]);
+                    ys[k] = Value::call(func_v, a, _coord).get_double();
+                }
+            };
+            if (chunks > 1 && pure) {
+                ThreadPool::instance().run(chunks, sample);
+            } else {
+                for (size_t c = 0; c < chunks; ++c) {
+                    sample(c);
+                }
+            }
+        };
+        Matrix plot = Plot::adaptive ? Plot::adaptive_sample(range(0, 0), range(0, range.size() - 1), batch)
+                                     : Plot::uniform(range, batch);
+        if (Plot::simplify > 0.0) {
+            plot = Plot::decimate(plot, Plot::simplify);
+        }
+        Value graphic(std::move(plot));
+        Node::reps[_coord].replacement = std::move(graphic);
     }
     else if (_tag == KEYWORD) {
         auto res = constants.find(_label);
@@ -519,8 +870,15 @@ Value Node::exec(name_table *scope = nullptr) {
             }
             std::vector<Value> args;
             for (auto & field : fields) {
-                Value val = field->exec(scope);    //эти функции не принимают только double-ы
-                args.push_back(val);
+                args.push_back(field->exec(scope));    //эти функции не принимают только double-ы
+            }
+            auto lin = funcs_matrix.find(_label);
+            if (lin != funcs_matrix.end()) {
+                return lin->second(args, _coord);
+            }
+            auto num = funcs_numeric.find(_label);
+            if (num != funcs_numeric.end()) {
+                return num->second(args, _coord);
             }
             if (argc == 1) {
                 if (_label == "\\floor" || Value::is_dimensionless(args[0])) {
@@ -6,32 +6,59 @@
 #include <iomanip>
 #include <algorithm>
 #include <utility>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
 #include "Node.h"
 #include "Error.h"
+#include "Matrix.h"
+#include "Dimension.h"
+#include "MatrixKernels.h"
+#include "NumberFormat.h"
+#include "Plot.h"
+#include "Memo.h"
 
 
+// Значение-функция хранит указатель на Func со счетчиком ссылок: копирование Value
+// не копирует ни аргументы, ни замыкание. После создания Func не изменяется
 typedef struct Func {
+    std::string name;                   //имя при объявлении: в теле оно обозначает саму функцию
     std::vector<std::string> argv;
     name_table local;
-    Node* body;
+    std::shared_ptr<const Node> body;   //тело неизменяемо и разделяется между копиями Func
+    std::atomic<size_t> refs;
+    mutable Memo memo;                  //запомненные результаты; у копии Func своя таблица
 
     Func(const Func &f);
 
-    Func(std::vector<std::string> as, name_table nt, Node *b);
-} Func;
+    Func(Func &&f) noexcept;
 
-typedef std::vector<std::vector<Value>> Matrix;
+    Func(std::string n, std::vector<std::string> as, name_table nt, std::shared_ptr<const Node> b);
+} Func;
 
 class Value {
 public:
-    typedef enum Type {
+    typedef enum Type : uint8_t {
         DOUBLE, MATRIX, FUNCTION, UNDEFINED, INFERRED_DOUBLE, INFERRED_MATRIX
     } Type;
 
-    Type _type;
-    std::array<int, 7> _dimension = dimensionless;
+    constexpr const static Dimension dimensionless = Dimension();
+
+    Type type() const {
+        return (Type) (_meta >> 56);
+    }
+
+    void set_type(Type t) {
+        _meta = (_meta & Dimension::mask) | ((uint64_t) t << 56);
+    }
 
-    constexpr const static std::array<int, 7> dimensionless = {0, 0, 0, 0, 0, 0, 0};
+    Dimension dimension() const {
+        return Dimension::from_word(_meta);
+    }
+
+    void set_dimension(const Dimension &dim) {
+        _meta = (_meta & ~Dimension::mask) | dim.word();
+    }
 
     static std::string type_string(Type t) {
         switch (t) {
@@ -64,74 +91,83 @@ public:
 private:
     union {
         double _double_data;
-        std::vector<std::vector<Value>> *_matrix_data;
+        Matrix *_matrix_data;           //собственная у каждого Value; буфер разделяется самой Matrix
         Func *_function_data;
     };
 
-public:
+    // слово размерности (младшие 56 бит) и тег (старший байт):
+    // вместе с данными Value занимает 16 байт (см. static_assert после класса)
+    uint64_t _meta;
 
-    static Value call(const Value &arg, std::vector<Value> arguments, const Coordinate& pos) {
-        Func *f = arg.get_function();
-        size_t sz = f->argv.size();
-        for (size_t i = 0; i < sz; ++i) {
-            f->local[f->argv[i]] = arguments[i];
-        }
-        return f->body->exec(&f->local);
+    static uint64_t pack(Type t, const Dimension &dim) {
+        return ((uint64_t) t << 56) | dim.word();
     }
 
+    void release_data();
+
+public:
+
+    static Value call(const Value &arg, std::vector<Value> arguments, const Coordinate& pos);
+
     Value();
 
-    Value(std::array<int, 7> dim);
+    Value(Dimension dim);
 
     Value(double d);
 
-    Value(double d, std::array<int, 7> dim);
+    Value(double d, Dimension dim);
 
     Value(Matrix m);
 
-    Value(Matrix m, std::array<int, 7> dim);
+    Value(Matrix m, Dimension dim);
 
-    Value(Func *f);
+    Value(Func *f);     //Value становится владельцем f
 
     Value(const Value &other);
 
+    Value(Value &&other) noexcept;
+
     Value &operator=(const Value &other);
 
+    Value &operator=(Value &&other) noexcept;
+
     ~Value();
 
-    friend std::string to_plot(const Value &matr) {
-        if (matr._type == MATRIX || matr._type == INFERRED_MATRIX) {
-            std::string res;
-            Matrix *m = &matr.get_matrix();
-            for (auto & it : *m) {
-                res += "(" + std::to_string(it[0].get_double()) + ","
-                       + std::to_string(it[1].get_double()) + ")\n";
-            }
-            return res;
+    // Точки графика (x,y) по строке на точку, с Plot::precision знаками после точки
+    friend void append_plot(std::string &out, const Value &matr) {
+        if (matr.type() == MATRIX || matr.type() == INFERRED_MATRIX) {
+            Plot::append_points(out, matr.get_matrix());
         }
+    }
 
-        return "";
+    friend std::string to_plot(const Value &matr) {
+        std::string res;
+        append_plot(res, matr);
+        return res;
     }
 
-    static int count_of_dim(const std::array<int, 7> &dim) {
+    static int count_of_dim(const Dimension &dim) {
         int count = 0;
-        for (int i : dim) {
+        for (int k = 0; k < Dimension::count; k++) {
+            int i = dim[k];
             if (i != 0) count++;
         }
         return count;
     }
 
-    static int count_of_pos_dim(const std::array<int, 7> &dim) {
+    static int count_of_pos_dim(const Dimension &dim) {
         int count = 0;
-        for (int i : dim) {
+        for (int k = 0; k < Dimension::count; k++) {
+            int i = dim[k];
             if (i > 0) count++;
         }
         return count;
     }
 
-    static int count_of_neg_dim(const std::array<int, 7> &dim) {
+    static int count_of_neg_dim(const Dimension &dim) {
         int count = 0;
-        for (int i : dim) {
+        for (int k = 0; k < Dimension::count; k++) {
+            int i = dim[k];
             if (i < 0) count++;
         }
         return count;
@@ -139,70 +175,70 @@ public:
 
     friend std::string dimension_to_String(const Value &val) {
         std::string dim;
-        int count = count_of_dim(val._dimension);
+        int count = count_of_dim(val.dimension());
         if (count != 0) {
             for (int i = 0; i < 7; i++) {
-                if (val._dimension[i] != 0) {
+                if (val.dimension()[i] != 0) {
                     switch (i) {
                         case 0: {
-                            if (val._dimension[i] == 1) {
+                            if (val.dimension()[i] == 1) {
                                 dim += " \\cdot m";
                             } else {
-                                dim += " \\cdot m^" + std::to_string(val._dimension[0]);
+                                dim += " \\cdot m^" + std::to_string(val.dimension()[0]);
                             }
                             count--;
                             break;
                         }
                         case 1: {
-                            if (val._dimension[i] == 1) {
+                            if (val.dimension()[i] == 1) {
                                 dim += " \\cdot kg";
                             } else {
-                                dim += " \\cdot kg^" + std::to_string(val._dimension[1]);
+                                dim += " \\cdot kg^" + std::to_string(val.dimension()[1]);
                             }
                             count--;
                             break;
                         }
                         case 2: {
-                            if (val._dimension[i] == 1) {
+                            if (val.dimension()[i] == 1) {
                                 dim += " \\cdot s";
                             } else {
-                                dim += " \\cdot s^" + std::to_string(val._dimension[2]);
+                                dim += " \\cdot s^" + std::to_string(val.dimension()[2]);
                             }
                             count--;
                             break;
                         }
                         case 3: {
-                            if (val._dimension[i] == 1) {
+                            if (val.dimension()[i] == 1) {
                                 dim += " \\cdot A";
                             } else {
-                                dim += " \\cdot A^" + std::to_string(val._dimension[3]);
+                                dim += " \\cdot A^" + std::to_string(val.dimension()[3]);
                             }
                             count--;
                             break;
                         }
                         case 4: {
-                            if (val._dimension[i] == 1) {
+                            if (val.dimension()[i] == 1) {
                                 dim += " \\cdot K";
                             } else {
-                                dim += " \\cdot K^" + std::to_string(val._dimension[4]);
+                                dim += " \\cdot K^" + std::to_string(val.dimension()[4]);
                             }
                             count--;
                             break;
                         }
                         case 5: {
-                            if (val._dimension[i] == 1) {
+                            if (val.dimension()[i] == 1) {
                                 dim += " \\cdot mol";
                             } else {
-                                dim += " \\cdot mol^" + std::to_string(val._dimension[5]);
+                                dim += " \\cdot mol^" + std::to_string(val.dimension()[5]);
                             }
                             count--;
                             break;
                         }
                         case 6: {
-                            if (val._dimension[i] == 1) {
+                            if (val.dimension()[i] == 1) {
                                 dim += " \\cdot cd";
                             } else {
-                                dim += " \\cdot cd^" + std::to_string(val._dimension[6]);
+                                dim += " \\cdot cd^" + std::to_string(val.dimension()[6]);
                             }
                             count--;
                             break;
@@ -221,67 +257,67 @@ public:
     friend std::string get_neg_dim(const Value &val, int countNeg) {
         std::string neg_dim;
         for (int i = 0; i < 7; i++) {
-            if (val._dimension[i] < 0) {
+            if (val.dimension()[i] < 0) {
                 switch (i) {
                     case 0: {
-                        if (val._dimension[i] == -1) {
+                        if (val.dimension()[i] == -1) {
                             neg_dim += "m";
                         } else {
-                            neg_dim += "m^" + std::to_string(-val._dimension[0]);
+                            neg_dim += "m^" + std::to_string(-val.dimension()[0]);
                         }
                         countNeg--;
                         break;
                     }
                     case 1: {
-                        if (val._dimension[i] == -1) {
+                        if (val.dimension()[i] == -1) {
                             neg_dim += "kg";
                         } else {
-                            neg_dim += "kg^" + std::to_string(-val._dimension[1]);
+                            neg_dim += "kg^" + std::to_string(-val.dimension()[1]);
                         }
                         countNeg--;
                         break;
                     }
                     case 2: {
-                        if (val._dimension[i] == -1) {
+                        if (val.dimension()[i] == -1) {
                             neg_dim += "s";
                         } else {
-                            neg_dim += "s^" + std::to_string(-val._dimension[2]);
+                            neg_dim += "s^" + std::to_string(-val.dimension()[2]);
                         }
                         countNeg--;
                         break;
                     }
                     case 3: {
-                        if (val._dimension[i] == -1) {
+                        if (val.dimension()[i] == -1) {
                             neg_dim += "A";
                         } else {
-                            neg_dim += "A^" + std::to_string(-val._dimension[3]);
+                            neg_dim += "A^" + std::to_string(-val.dimension()[3]);
                         }
                         countNeg--;
                         break;
                     }
                     case 4: {
-                        if (val._dimension[i] == -1) {
+                        if (val.dimension()[i] == -1) {
                             neg_dim += "K";
                         } else {
-                            neg_dim += "K^" + std::to_string(-val._dimension[4]);
+                            neg_dim += "K^" + std::to_string(-val.dimension()[4]);
                         }
                         countNeg--;
                         break;
                     }
                     case 5: {
-                        if (val._dimension[i] == -1) {
+                        if (val.dimension()[i] == -1) {
                             neg_dim += "mol";
                         } else {
-                            neg_dim += "mol^" + std::to_string(-val._dimension[5]);
+                            neg_dim += "mol^" + std::to_string(-val.dimension()[5]);
                         }
                         countNeg--;
                         break;
                     }
                     case 6: {
-                        if (val._dimension[i] == -1) {
+                        if (val.dimension()[i] == -1) {
                             neg_dim += "cd";
                         } else {
-                            neg_dim += "cd^" + std::to_string(-val._dimension[6]);
+                            neg_dim += "cd^" + std::to_string(-val.dimension()[6]);
                         }
                         countNeg--;
                         break;
@@ -303,67 +339,67 @@ public:
     friend std::string get_pos_dim(const Value &val, int countPos) {
         std::string dim;
         for (int i = 0; i < 7; i++) {
-            if (val._dimension[i] > 0) {
+            if (val.dimension()[i] > 0) {
                 switch (i) {
                     case 0: {
-                        if (val._dimension[i] == 1) {
+                        if (val.dimension()[i] == 1) {
                             dim += "m";
                         } else {
-                            dim += "m^" + std::to_string(val._dimension[0]);
+                            dim += "m^" + std::to_string(val.dimension()[0]);
                         }
                         countPos--;
                         break;
                     }
                     case 1: {
-                        if (val._dimension[i] == 1) {
+                        if (val.dimension()[i] == 1) {
                             dim += "kg";
                         } else {
-                            dim += "kg^" + std::to_string(val._dimension[1]);
+                            dim += "kg^" + std::to_string(val.dimension()[1]);
                         }
                         countPos--;
                         break;
                     }
                     case 2: {
-                        if (val._dimension[i] == 1) {
+                        if (val.dimension()[i] == 1) {
                             dim += "s";
                         } else {
-                            dim += "s^" + std::to_string(val._dimension[2]);
+                            dim += "s^" + std::to_string(val.dimension()[2]);
                         }
                         countPos--;
                         break;
                     }
                     case 3: {
-                        if (val._dimension[i] == 1) {
+                        if (val.dimension()[i] == 1) {
                             dim += "A";
                         } else {
-                            dim += "A^" + std::to_string(val._dimension[3]);
+                            dim += "A^" + std::to_string(val.dimension()[3]);
                         }
                         countPos--;
                         break;
                     }
                     case 4: {
-                        if (val._dimension[i] == 1) {
+                        if (val.dimension()[i] == 1) {
                             dim += "K";
                         } else {
-                            dim += "K^" + std::to_string(val._dimension[4]);
+                            dim += "K^" + std::to_string(val.dimension()[4]);
                         }
                         countPos--;
                         break;
                     }
                     case 5: {
-                        if (val._dimension[i] == 1) {
+                        if (val.dimension()[i] == 1) {
                             dim += "mol";
                         } else {
-                            dim += "mol^" + std::to_string(val._dimension[5]);
+                            dim += "mol^" + std::to_string(val.dimension()[5]);
                         }
                         countPos--;
                         break;
                     }
                     case 6: {
-                        if (val._dimension[i] == 1) {
+                        if (val.dimension()[i] == 1) {
                             dim += "cd";
                         } else {
-                            dim += "cd^" + std::to_string(val._dimension[6]);
+                            dim += "cd^" + std::to_string(val.dimension()[6]);
                         }
                         countPos--;
                         break;
@@ -385,8 +421,8 @@ public:
 
     friend std::string getDimension_in_frac(const Value &val) {
         std::string dim;
-        int countPos = count_of_pos_dim(val._dimension);
-        int countNeg = count_of_neg_dim(val._dimension);
+        int countPos = count_of_pos_dim(val.dimension());
+        int countNeg = count_of_neg_dim(val.dimension());
         if (countNeg != 0) {
             if (countPos != 0) {
                 dim = " \\cdot \\frac{";
@@ -404,51 +440,69 @@ public:
         return dim;
     }
 
-    static std::string double_to_String(double d) {
+    // Приведение double к целому так, как его выполняет процессор (x86): значения вне
+    // диапазона и NaN дают наименьшее целое. Нужно, чтобы вывод чисел не изменился
+    static int truncate_int(double x) {
+        return (x > -2147483649.0 && x < 2147483648.0) ? (int) x : INT32_MIN;
+    }
 
-        std::stringstream streamObj;
-        streamObj << std::fixed;
-        streamObj << std::setprecision(5);
-        double short_d, f;
-        streamObj << d;
-        streamObj >> short_d;
-        std::string res;
+    static long truncate_long(double x) {
+        return (x >= -9223372036854775808.0 && x < 9223372036854775808.0) ? (long) x : INT64_MIN;
+    }
 
+    // Число округляется до 5 знаков (как при выводе в поток с setprecision(5) и чтении обратно;
+    // inf и nan поток не читает, тогда получается 0), дробная часть пишется без ведущих нулей
+    static void append_double(std::string &out, double d) {
+        char buf[400];
+        auto text = std::to_chars(buf, buf + sizeof(buf), d, std::chars_format::fixed, 5);
+        double short_d = 0.0, f;
+        if (std::isfinite(d)) {
+            std::from_chars(buf, text.ptr, short_d);
+        }
         if (std::modf(d, &f) == 0) {
-            return std::to_string((int) short_d);
+            append_integer(out, truncate_int(short_d));
         } else {
-            double mod = modf(short_d, &f);
-            long mod2 = (long) (mod * 100000);
-            return std::to_string((long) (short_d)) + "." + std::to_string(mod2);
+            double mod = std::modf(short_d, &f);
+            append_integer(out, truncate_long(short_d));
+            out += '.';
+            append_integer(out, truncate_long(mod * 100000));
         }
     }
 
+    static std::string double_to_String(double d) {
+        std::string res;
+        append_double(res, d);
+        return res;
+    }
+
     friend std::string to_string(const Value &val) {
-        if (val._type == DOUBLE || val._type == INFERRED_DOUBLE) {
+        if (val.type() == DOUBLE || val.type() == INFERRED_DOUBLE) {
             return double_to_String(val._double_data) + getDimension_in_frac(val);
         }
-        if (val._type == MATRIX || val._type == INFERRED_MATRIX) {
+        if (val.type() == MATRIX || val.type() == INFERRED_MATRIX) {
+            const Matrix &m = val.get_matrix();
+            std::string dim = getDimension_in_frac(val);   //размерность у всех элементов общая
             std::string res = "\\begin{pmatrix}\n";
-            for (auto it = (*val._matrix_data).begin();;) {
-                auto jt = (*it).begin();
-                res += to_string(*jt);
-                ++jt;
-                for (; jt != (*it).end(); ++jt) {
+            for (size_t i = 0;;) {
+                append_double(res, m(i, 0));
+                res += dim;
+                for (size_t j = 1; j < m.cols(); ++j) {
                     res += " & ";
-                    res += to_string(*jt);
+                    append_double(res, m(i, j));
+                    res += dim;
                 }
-                ++it;
-                if (it != (*val._matrix_data).end()) {
+                ++i;
+                if (i != m.rows()) {
                     res += "\\\\\n";
                 } else break;
             }
             res += "\\end{pmatrix}";
             return res;
         }
-        if (val._type == FUNCTION) {
+        if (val.type() == FUNCTION) {
             return "function"; //или должно быть имя?
         }
-        if (val._type == UNDEFINED) {
+        if (val.type() == UNDEFINED) {
             return "undefined";
         }
 
@@ -457,44 +511,30 @@ public:
 
     double get_double() const;
 
-    std::array<int, 7> get_dimension() const;
+    Dimension get_dimension() const;
 
-    Matrix& get_matrix() const;
+    const Matrix& get_matrix() const;
+
+    Matrix& edit_matrix();
 
     Func* get_function() const;
 
     static bool is_equal_dim(const Value &left, const Value &right) {
-        for (int i = 0; i < 7; i++) {
-            if (left._dimension[i] != right._dimension[i]) {
-                return false;
-            }
-        }
-        return true;
+        return left.dimension() == right.dimension();
     }
 
     static bool is_dimensionless(const Value &value) {
-        for (int i : value._dimension) {
-            if (i != 0) {
-                return false;
-            }
-        }
-        return true;
+        return value.dimension().is_zero();
     }
 
     static Value plus(const Value &left, const Value &right, const Coordinate& pos) {
-        if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) { //если right - не DOUBLE, сработает исключение
-            return {left.get_double() + right.get_double(), left._dimension};
-        } else if (left._type == MATRIX || left._type == INFERRED_MATRIX) {
-            Matrix *l = &left.get_matrix();
-            Matrix *r = &right.get_matrix();
-            if ((*l).size() == (*r).size() && (*l)[0].size() == (*r)[0].size()) {
-                Matrix sum(l->size());
-                for (size_t i = 0; i < (*l).size(); ++i) {
-                    for (size_t j = 0; j < (*l)[0].size(); ++j) {
-                        sum[i].push_back(plus((*l)[i][j], (*r)[i][j], pos));
-                    }
-                }
-                return {sum};
+        if (left.type() == DOUBLE || left.type() == INFERRED_DOUBLE) { //если right - не DOUBLE, сработает исключение
+            return {left.get_double() + right.get_double(), left.dimension()};
+        } else if (left.type() == MATRIX || left.type() == INFERRED_MATRIX) {
+            const Matrix &l = left.get_matrix();
+            const Matrix &r = right.get_matrix();
+            if (l.same_shape(r)) {
+                return {elementwise(l, r, vec_add), left.dimension()};
             } else {
                 throw Error(pos, "Matrix dimensions mismatch");
             }
@@ -503,35 +543,23 @@ public:
     }
 
     static Value usub(const Value &arg, const Coordinate& pos) {
-        if (arg._type == DOUBLE || arg._type == INFERRED_DOUBLE) {
-            return {-arg.get_double(), arg._dimension};
-        } else if (arg._type == MATRIX || arg._type == INFERRED_MATRIX) {
-            Matrix *a = &arg.get_matrix();
-            Matrix res(a->size());
-            for (size_t i = 0; i < res.size(); ++i) {
-                for (size_t j = 0; j < res[i].size(); ++j) {
-                    res[i].push_back(usub((*a)[i][j], pos));
-                }
-            }
-            return {res};
+        if (arg.type() == DOUBLE || arg.type() == INFERRED_DOUBLE) {
+            return {-arg.get_double(), arg.dimension()};
+        } else if (arg.type() == MATRIX || arg.type() == INFERRED_MATRIX) {
+            const Matrix &a = arg.get_matrix();
+            return {scaled(a, -1.0), arg.dimension()};
         }
         throw Error(pos, "Substitution cannot be done");
     }
 
     static Value sub(const Value &left, const Value &right, const Coordinate& pos) {
-        if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) {
-            return {left.get_double() - right.get_double(), left._dimension};
-        } else if (left._type == MATRIX || left._type == INFERRED_MATRIX) {
-            Matrix *l = &left.get_matrix();
-            Matrix *r = &right.get_matrix();
-            if ((*l).size() == (*r).size() && (*l)[0].size() == (*r)[0].size()) {
-                Matrix dif(l->size());
-                for (size_t i = 0; i < (*l).size(); ++i) {
-                    for (size_t j = 0; j < (*l)[0].size(); ++j) {
-                        dif[i].push_back(sub((*l)[i][j], (*r)[i][j], pos));
-                    }
-                }
-                return {dif};
+        if (left.type() == DOUBLE || left.type() == INFERRED_DOUBLE) {
+            return {left.get_double() - right.get_double(), left.dimension()};
+        } else if (left.type() == MATRIX || left.type() == INFERRED_MATRIX) {
+            const Matrix &l = left.get_matrix();
+            const Matrix &r = right.get_matrix();
+            if (l.same_shape(r)) {
+                return {elementwise(l, r, vec_sub), left.dimension()};
             } else {
                 throw Error(pos, "Matrix dimensions mismatch");
             }
@@ -540,56 +568,41 @@ public:
     }
 
     static Value mul(const Value &left, const Value &right, const Coordinate& pos) {
-        if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) {
-            if (right._type == DOUBLE || right._type == INFERRED_DOUBLE) {
-                std::array<int, 7> dim{};
-                for (int i = 0; i < 7; i++) {
-                    dim[i] = left._dimension[i] + right._dimension[i];
-                }
-                return {left.get_double() * right.get_double(), dim};
-
-            } else if (right._type == MATRIX || right._type == INFERRED_MATRIX) {
-                Matrix *r = &right.get_matrix();
-                Matrix mult((*r).size());
-                for (size_t i = 0; i < (*r).size(); ++i) {
-                    for (size_t j = 0; j < (*r)[0].size(); ++j) {
-                        mult[i].push_back(mul(left, (*r)[i][j], pos));
-                    }
-                }
-                return {mult};
+        if (left.type() == DOUBLE || left.type() == INFERRED_DOUBLE) {
+            if (right.type() == DOUBLE || right.type() == INFERRED_DOUBLE) {
+                return {left.get_double() * right.get_double(), sum_dimensions(left.dimension(), right.dimension(), pos)};
+
+            } else if (right.type() == MATRIX || right.type() == INFERRED_MATRIX) {
+                const Matrix &r = right.get_matrix();
+                return {scaled(r, left.get_double()), sum_dimensions(left.dimension(), right.dimension(), pos)};
             }
-        } else if (left._type == MATRIX || left._type == INFERRED_MATRIX) {
-            if (right._type == DOUBLE || right._type == INFERRED_DOUBLE) {
+        } else if (left.type() == MATRIX || left.type() == INFERRED_MATRIX) {
+            if (right.type() == DOUBLE || right.type() == INFERRED_DOUBLE) {
                 return mul(right, left, pos);
-            } else if (right._type == MATRIX || right._type == INFERRED_MATRIX) {
-                Matrix *l = &left.get_matrix();
-                Matrix *r = &right.get_matrix();
-                size_t l_hor = (*l)[0].size();
-                size_t l_vert = (*l).size();
-                size_t r_vert = (*r).size();
-                size_t r_hor = (*r)[0].size();
+            } else if (right.type() == MATRIX || right.type() == INFERRED_MATRIX) {
+                const Matrix &l = left.get_matrix();
+                const Matrix &r = right.get_matrix();
+                size_t l_hor = l.cols();
+                size_t l_vert = l.rows();
+                size_t r_vert = r.rows();
+                size_t r_hor = r.cols();
 
                 if (l_hor == r_vert) {
-                    Matrix mult((*l).size());
-                    for (size_t i = 0; i < l_vert; ++i) {
-                        for (size_t j = 0; j < r_hor; ++j) {
-                            Value tmp = mul((*l)[i][0], (*r)[0][j], pos);
-                            for (size_t k = 1; k < (*r).size(); ++k) {
-                                tmp = plus(tmp, mul((*l)[i][k], (*r)[k][j], pos), pos);
-                            }
-                            mult[i].push_back(tmp);
-                        }
-                    }
-                    return {mult};
+                    Matrix mult(l_vert, r_hor);
+                    gemm(l_vert, r_hor, l_hor,
+                         l.data(), l.row_stride(), l.col_stride(),
+                         r.data(), r.row_stride(), r.col_stride(),
+                         mult.data(), r_hor, 1);
+                    return {std::move(mult), sum_dimensions(left.dimension(), right.dimension(), pos)};
                 }
 
                 //скалярное произведение
                 else if (l_vert == 1 && r_vert == 1) {    //строка*строка => строка*столбец
-                    Value res = Value::mul(*l, Value::transpose(*r), pos);    //если длины строк равны, mul выполнится
-                    return {res.get_matrix()[0][0]};
+                    Value res = Value::mul(left, Value::transpose(right), pos);    //если длины строк равны, mul выполнится
+                    return {res.get_matrix()(0, 0), res.dimension()};
                 } else if (l_hor == 1 && r_hor == 1) {    //столбец*столбец => строка*столбец
-                    Value res = Value::mul(Value::transpose(*l), *r, pos);
-                    return {res.get_matrix()[0][0]};
+                    Value res = Value::mul(Value::transpose(left), right, pos);
+                    return {res.get_matrix()(0, 0), res.dimension()};
                 }
                 throw Error(pos, "Matrix/vector dimensions mismatch");
             }
@@ -598,25 +611,21 @@ public:
     }
 
     static Value div(const Value &left, const Value &right, const Coordinate& pos) {
-        if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) {
-            if (right._type == DOUBLE || right._type == INFERRED_DOUBLE) {
+        if (left.type() == DOUBLE || left.type() == INFERRED_DOUBLE) {
+            if (right.type() == DOUBLE || right.type() == INFERRED_DOUBLE) {
                 double q = right.get_double();
                 if (q == 0.0) {
                     throw Error(pos, "Division by zero");
                 }
-                std::array<int, 7> dim{};
-                for (int i = 0; i < 7; i++) {
-                    dim[i] = left._dimension[i] - right._dimension[i];
-                }
-                return {left.get_double() / q, dim};
+                return {left.get_double() / q, sub_dimensions(left.dimension(), right.dimension(), pos)};
             }
-        } else if (left._type == MATRIX || left._type == INFERRED_MATRIX) {
-            if (right._type == DOUBLE || right._type == INFERRED_DOUBLE) {
+        } else if (left.type() == MATRIX || left.type() == INFERRED_MATRIX) {
+            if (right.type() == DOUBLE || right.type() == INFERRED_DOUBLE) {
                 double q = right.get_double();
                 if (q == 0.0) {
                     throw Error(pos, "Division by zero");
                 }
-                return mul(Value(1.0 / q), left, pos);
+                return mul(Value(1.0 / q, sub_dimensions(dimensionless, right.dimension(), pos)), left, pos);
             }
         }
 
@@ -625,28 +634,22 @@ public:
 
     static Value eq(const Value &left, const Value &right, const Coordinate& pos) {
         if (!(
-            (left._type == DOUBLE || right._type == INFERRED_DOUBLE) &&
-            (right._type == DOUBLE || right._type == INFERRED_DOUBLE)
+            (left.type() == DOUBLE || right.type() == INFERRED_DOUBLE) &&
+            (right.type() == DOUBLE || right.type() == INFERRED_DOUBLE)
             ||
-            (left._type == MATRIX || right._type == INFERRED_MATRIX) &&
-            (right._type == MATRIX || right._type == INFERRED_MATRIX)
+            (left.type() == MATRIX || right.type() == INFERRED_MATRIX) &&
+            (right.type() == MATRIX || right.type() == INFERRED_MATRIX)
         )) {
             return {0.0, dimensionless};  //точно не равны
         }
-        if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) {
+        if (left.type() == DOUBLE || left.type() == INFERRED_DOUBLE) {
             return {static_cast<double>(left.get_double() == right.get_double())};
         }
-        if (left._type == MATRIX || left._type == INFERRED_MATRIX) {
-            Matrix *l = &left.get_matrix();
-            Matrix *r = &right.get_matrix();
-            if (l->size() == r->size() && (*l)[0].size() == (*r)[0].size()) {
-                for (size_t i = 0; i < l->size(); ++i) {
-                    for (size_t j = 0; j < (*l)[0].size(); ++j) {
-                        Value x = eq((*l)[i][j], (*r)[i][j], pos);
-                        if (x.get_double() == 0.0) return {0.0, dimensionless};
-                    }
-                }
-                return {1.0, dimensionless};
+        if (left.type() == MATRIX || left.type() == INFERRED_MATRIX) {
+            const Matrix &l = left.get_matrix();
+            const Matrix &r = right.get_matrix();
+            if (l.same_shape(r)) {
+                return {equal(l, r) ? 1.0 : 0.0, dimensionless};
             }
         }
 
@@ -670,12 +673,14 @@ public:
         return {static_cast<double>(left.get_double() > right.get_double())};
     }
 
-    static std::array<int, 7> mul_dimension(std::array<int, 7> dim, double n) {
-        std::array<int, 7> tmp_dim = dim;
-        for (int i = 0; i < 7; i++) {
-            tmp_dim[i] = dim[i] * n;
+    static Dimension mul_dimension(const Dimension &dim, double n, const Coordinate& pos) {
+        if (dim.is_zero()) {
+            return dim;
         }
-        return tmp_dim;
+        if (std::abs(n) * dim.max_abs() > 127) {
+            throw Error(pos, "Dimension exponent is out of range");
+        }
+        return dim * (int) n;
     }
 
     static Value pow(const Value &left, const Value &right, const Coordinate& pos) {
@@ -684,13 +689,13 @@ public:
         if (Value::is_dimensionless(left)) {
             return {
                     std::pow(left.get_double(), right.get_double()),
-                    mul_dimension(left.get_dimension(), right.get_double())
+                    mul_dimension(left.get_dimension(), right.get_double(), pos)
                   };
         } else if (modf(right.get_double(), &floor) == 0.0) {
             return {
                     std::pow(left.get_double(),
                     right.get_double()),
-                  mul_dimension(left.get_dimension(), right.get_double())
+                  mul_dimension(left.get_dimension(), right.get_double(), pos)
                   };
         } else {
             throw Error(pos, "Power of float number is not allowed");
@@ -698,7 +703,7 @@ public:
     }
 
     static Value abs(const Value &right, const Coordinate& pos) {
-        return {std::abs(right.get_double()), right._dimension};
+        return {std::abs(right.get_double()), right.dimension()};
     }
 
     static Value andd(const Value &left, const Value &right, const Coordinate& pos) {
@@ -709,95 +714,242 @@ public:
         return {static_cast<double>(left.get_double() || right.get_double())};
     }
 
+    // Транспонирование не копирует элементы: результат - представление над тем же буфером,
+    // ядра читают его через шаги, а копия делается только перед записью
     static Value transpose(const Value &matrix) {
-        Matrix *m = &matrix.get_matrix();
-        Matrix mt;
-        size_t rows = (*m)[0].size();
-        size_t cols = (*m).size();
-        mt.resize(rows);
-        for (size_t i = 0; i < rows; ++i) {
-            mt[i].resize(cols);
-            for (size_t j = 0; j < cols; ++j) {
-                mt[i][j] = (*m)[j][i];
+        return {matrix.get_matrix().transposed(), matrix.dimension()};
+    }
+
+    // Определитель, обратная матрица и решение системы A x = b через LU-разложение.
+    // Размерности: det A - [A]^n, A^-1 - [A]^-1, x - [b] / [A]
+    static Value det(const Value &matrix, const Coordinate& pos) {
+        const Matrix &m = square(matrix, pos);
+        size_t n = m.rows();
+        Matrix lu = m;
+        std::vector<size_t> piv(n);
+        int sign;
+        double d = 0.0;
+        if (lu_decompose(n, lu.data(), piv.data(), sign)) {
+            d = sign;
+            for (size_t i = 0; i < n; ++i) {
+                d *= lu(i, i);
             }
         }
-        return {mt};
+        return {d, mul_dimension(matrix.dimension(), (double) n, pos)};
     }
 
-    // Проверка идентичности размерностей
-    static bool check_dimensions(const int* first, const int* second) {
-        for (int i = 0; i < 7; i++) {
-            if (first[i] != second[i]) {
-                return false;
-            }
+    static Value inv(const Value &matrix, const Coordinate& pos) {
+        const Matrix &m = square(matrix, pos);
+        size_t n = m.rows();
+        Matrix res(n, n);
+        for (size_t i = 0; i < n; ++i) {
+            res(i, i) = 1.0;
         }
+        lu_solve_into(m, res, pos);
+        return {std::move(res), mul_dimension(matrix.dimension(), -1.0, pos)};
+    }
 
-        return true;
+    static Value solve(const Value &matrix, const Value &rhs, const Coordinate& pos) {
+        const Matrix &m = square(matrix, pos);
+        if ((rhs.type() != MATRIX && rhs.type() != INFERRED_MATRIX) || rhs.get_matrix().rows() != m.rows()) {
+            throw Error(pos, "Matrix/vector dimensions mismatch");
+        }
+        Matrix res = rhs.get_matrix();
+        lu_solve_into(m, res, pos);
+        return {std::move(res), sub_dimensions(rhs.dimension(), matrix.dimension(), pos)};
     }
 
-    static bool check_dimensions(const std::array<int, 7> first, const std::array<int, 7> second) {
-        for (int i = 0; i < 7; i++) {
-            if (first[i] != second[i]) {
-                return false;
+    // \integral(f, a, b) и \findroot(f, a, b) для функции f одного аргумента (Value.cpp).
+    // Размерности: интеграл - [f] [x], корень - размерность границ
+    static Value integral(const Value &func, const Value &a, const Value &b, const Coordinate& pos);
+
+    static Value findroot(const Value &func, const Value &a, const Value &b, const Coordinate& pos);
+
+    // \odesolve(f, y0, t0, t1): решение y' = f(t, y) (или y' = f(y)) от состояния y0 - числа или вектора.
+    // Результат - траектория: строки (t, y_1, ..., y_n) в шагах решателя. У матрицы одна размерность
+    // на все элементы, а у t и y они разные, поэтому элементы - числа в единицах СИ без размерности;
+    // размерность производной проверяется на каждом вызове: [f] = [y] / [t]
+    static Value odesolve(const Value &func, const Value &init, const Value &t0, const Value &t1,
+                          const Coordinate& pos);
+
+    // Элемент матрицы (i, j) как скаляр с размерностью матрицы
+    static Value element(const Value &matrix, size_t i, size_t j) {
+        return {matrix.get_matrix()(i, j), matrix.dimension()};
+    }
+
+    // Размерность у матрицы одна на все элементы. Элемент с другой размерностью можно
+    // записать, только если все остальные элементы нулевые (ноль имеет любую размерность):
+    // тогда матрица принимает размерность нового элемента
+    static void set_element(Value &matrix, size_t i, size_t j, const Value &val, const Coordinate& pos) {
+        Matrix &m = matrix.edit_matrix();
+        double x = val.get_double();
+        if (x != 0.0 && !check_dimensions(matrix.dimension(), val.dimension())) {
+            const double *d = m.data();
+            for (size_t k = 0; k < m.size(); ++k) {
+                if (k != i * m.cols() + j && d[k] != 0.0) {
+                    throw Error(pos, "Matrix elements must have the same dimension");
+                }
             }
+            matrix.set_dimension(val.dimension());
         }
-
-        return true;
+        m(i, j) = x;
     }
 
-    static std::array<int, 7> sum_dimensions(const std::array<int, 7> first, const std::array<int, 7> second) {
-        std::array<int, 7> new_dims = std::array<int, 7>();
+    // Срез: строка k (row == true) или столбец k как матрица над тем же буфером
+    static Value slice(const Value &matrix, bool row, size_t k) {
+        const Matrix &m = matrix.get_matrix();
+        return {row ? m.row(k) : m.col(k), matrix.dimension()};
+    }
 
-        for (int i = 0; i < 7; i++) {
-            new_dims[i] = first[i] + second[i];
+    // Запись строки или столбца k из вектора той же длины (строки или столбца).
+    // Правило для размерностей то же, что в set_element
+    static void set_slice(Value &matrix, bool row, size_t k, const Value &val, const Coordinate& pos) {
+        const Matrix &v = val.get_matrix();
+        Matrix &m = matrix.edit_matrix();
+        size_t n = row ? m.cols() : m.rows();
+        if ((v.rows() != 1 && v.cols() != 1) || v.size() != n) {
+            throw Error(pos, "Slice length mismatch");
+        }
+        double *d = m.data();
+        if (!check_dimensions(matrix.dimension(), val.dimension()) && !equal(v, Matrix(v.rows(), v.cols()))) {
+            for (size_t i = 0; i < m.rows(); ++i) {
+                for (size_t j = 0; j < m.cols(); ++j) {
+                    if ((row ? i : j) != k && d[i * m.cols() + j] != 0.0) {
+                        throw Error(pos, "Matrix elements must have the same dimension");
+                    }
+                }
+            }
+            matrix.set_dimension(val.dimension());
         }
+        for (size_t t = 0; t < n; ++t) {
+            double x = (v.rows() == 1) ? v(0, t) : v(t, 0);
+            if (row) {
+                d[k * m.cols() + t] = x;
+            } else {
+                d[t * m.cols() + k] = x;
+            }
+        }
+    }
 
-        return new_dims;
+    // Поэлементные операции. Непрерывные операнды обрабатываются одним вызовом ядра,
+    // срезы - построчно: строка с шагом больше единицы сначала копируется во временный массив
+    static const double *row_of(const Matrix &m, size_t i, std::vector<double> &tmp) {
+        if (m.cols() <= 1 || m.col_stride() == 1) {
+            return m.data() + i * m.row_stride();
+        }
+        for (size_t j = 0; j < m.cols(); ++j) {
+            tmp[j] = m(i, j);
+        }
+        return tmp.data();
     }
 
-    static std::array<int, 7> sub_dimensions(const std::array<int, 7> first, const std::array<int, 7> second) {
-        std::array<int, 7> new_dims = std::array<int, 7>();
+    static const Matrix &square(const Value &matrix, const Coordinate& pos) {
+        if (matrix.type() != MATRIX && matrix.type() != INFERRED_MATRIX) {
+            throw Error(pos, "Square matrix expected");
+        }
+        const Matrix &m = matrix.get_matrix();
+        if (m.rows() != m.cols() || m.size() == 0) {
+            throw Error(pos, "Square matrix expected");
+        }
+        return m;
+    }
 
-        for (int i = 0; i < 7; i++) {
-            new_dims[i] = first[i] - second[i];
+    // Заменяет rhs на решение m x = rhs
+    static void lu_solve_into(const Matrix &m, Matrix &rhs, const Coordinate& pos) {
+        size_t n = m.rows();
+        Matrix lu = m;
+        std::vector<size_t> piv(n);
+        int sign;
+        if (!lu_decompose(n, lu.data(), piv.data(), sign)) {
+            throw Error(pos, "Matrix is singular");
         }
+        lu_solve(n, static_cast<const Matrix &>(lu).data(), piv.data(), rhs.data(), rhs.cols());
+    }
 
-        return new_dims;
+    static Matrix elementwise(const Matrix &l, const Matrix &r,
+                              void (*kernel)(size_t, const double *, const double *, double *)) {
+        Matrix res(l.rows(), l.cols());
+        double *out = res.data();
+        if (l.contiguous() && r.contiguous()) {
+            kernel(l.size(), l.data(), r.data(), out);
+            return res;
+        }
+        size_t n = l.cols();
+        std::vector<double> lrow(n), rrow(n);
+        for (size_t i = 0; i < l.rows(); ++i) {
+            kernel(n, row_of(l, i, lrow), row_of(r, i, rrow), out + i * n);
+        }
+        return res;
     }
 
-    static std::array<int, 7> mul_dimensions(const std::array<int, 7> dims, int degree) {
-        std::array<int, 7> new_dims = std::array<int, 7>();
+    static Matrix scaled(const Matrix &a, double k) {
+        Matrix res(a.rows(), a.cols());
+        double *out = res.data();
+        if (a.contiguous()) {
+            vec_scale(a.size(), k, a.data(), out);
+            return res;
+        }
+        size_t n = a.cols();
+        std::vector<double> row(n);
+        for (size_t i = 0; i < a.rows(); ++i) {
+            vec_scale(n, k, row_of(a, i, row), out + i * n);
+        }
+        return res;
+    }
 
-        for (int i = 0; i < 7; i++) {
-            new_dims[i] = dims[i] * degree;
+    static bool equal(const Matrix &l, const Matrix &r) {
+        if (l.contiguous() && r.contiguous()) {
+            return vec_equal(l.size(), l.data(), r.data());
         }
+        size_t n = l.cols();
+        std::vector<double> lrow(n), rrow(n);
+        for (size_t i = 0; i < l.rows(); ++i) {
+            if (!vec_equal(n, row_of(l, i, lrow), row_of(r, i, rrow))) return false;
+        }
+        return true;
+    }
 
-        return new_dims;
+    // Проверка идентичности размерностей
+    static bool check_dimensions(const Dimension &first, const Dimension &second) {
+        return first == second;
     }
 
-    static bool is_dimensionless(const int* dims) {
-        for (int i = 0; i < 7; i++) {
-            if (dims[i] != 0) {
-                return false;
-            }
-        }
+    static Dimension sum_dimensions(const Dimension &first, const Dimension &second) {
+        return first + second;
+    }
 
-        return true;
+    static Dimension sub_dimensions(const Dimension &first, const Dimension &second) {
+        return first - second;
     }
 
-    static bool is_matrix_equals_dims(const Matrix& first, const Matrix& second) {
-        if (first.size() != second.size()) {
-            return false;
+    // То же при вычислении: показатель вне [-128, 127] - ошибка в позиции pos, как в mul_dimension
+    static Dimension sum_dimensions(const Dimension &first, const Dimension &second, const Coordinate& pos) {
+        Dimension res;
+        if (!Dimension::add(first, second, res)) {
+            throw Error(pos, "Dimension exponent is out of range");
         }
+        return res;
+    }
 
-        if (first[0].size() != second[0].size()) {
-            return false;
+    static Dimension sub_dimensions(const Dimension &first, const Dimension &second, const Coordinate& pos) {
+        Dimension res;
+        if (!Dimension::sub(first, second, res)) {
+            throw Error(pos, "Dimension exponent is out of range");
         }
+        return res;
+    }
 
-        return true;
+    static Dimension mul_dimensions(const Dimension &dims, int degree) {
+        return dims * degree;
+    }
+
+    static bool is_matrix_equals_dims(const Matrix& first, const Matrix& second) {
+        return first.same_shape(second);
     }
 };
 
+static_assert(sizeof(Value) == 16, "Value must stay 16 bytes: tag, packed dimension and payload");
+
 typedef struct Replacement {
     Tag tag;
     size_t begin;
@@ -806,5 +958,5 @@ typedef struct Replacement {
 
     Replacement();
 
-    Replacement(Tag, size_t, size_t, const Value& = Value(0.0, Value::dimensionless));
+    Replacement(Tag, size_t, size_t, Value = Value(0.0, Value::dimensionless));
 } Replacement;
\ No newline at end of file
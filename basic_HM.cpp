@@ -182,10 +182,146 @@ Node* copy_type(
 }
 
 
+// Обращение по индексу: элемент матрицы - число той же размерности, A_{i,*} и A_{*,j} - строка и столбец
+static Value indexed(const Value &val, Node *node) {
+    if (node->fields.empty() || (val.type() != Value::MATRIX && val.type() != Value::INFERRED_MATRIX)) {
+        return val;
+    }
+    bool row = node->fields.size() == 2 && node->fields[1]->get_tag() == Tag::SLICE;
+    bool col = node->fields[0]->get_tag() == Tag::SLICE;
+    if (!row && !col) {
+        Value res(0.0, val.dimension());
+        res.set_type(Value::INFERRED_DOUBLE);
+        return res;
+    }
+    if (row && col) {
+        return val;
+    }
+    if (val.type() == Value::MATRIX && val.get_matrix().size() > 0) {
+        return Value::slice(val, row, 0);
+    }
+    return val;
+}
+
+// \det, \inv, \solve: форма и размерность результата без вычисления (матрицы при анализе нулевые)
+static std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse_linear(
+    Node *node,
+    bool inside_func_or_block,
+    std::vector<std::pair<std::string, Value>> local_vars,
+    bool is_usub
+) {
+    const auto& name = node->get_label();
+    size_t argc = name == "\\solve" ? 2 : 1;
+    if (node->fields.size() != argc) {
+        throw std::invalid_argument("Wrong argument number in node: " + node->toString());
+    }
+    std::vector<Value> args;
+    bool known = true;
+    for (auto field : node->fields) {
+        auto res = analyse(field, inside_func_or_block, std::move(local_vars), is_usub);
+        local_vars = std::move(res.second);
+        if (res.first.type() == Value::DOUBLE || res.first.type() == Value::INFERRED_DOUBLE) {
+            throw std::invalid_argument(
+                    "Cannot use " + name + " on non matrix value: " + to_string(res.first) +
+                    " in node: " + node->toString()
+            );
+        }
+        known = known && res.first.type() == Value::MATRIX;
+        args.push_back(std::move(res.first));
+    }
+    if (!known) {   //аргумент функции: форма станет известна только при вызове
+        Value res;
+        if (name == "\\det") {
+            res.set_type(Value::INFERRED_DOUBLE);
+        }
+        return {res, std::move(local_vars)};
+    }
+    const Matrix &m = args[0].get_matrix();
+    if (m.rows() != m.cols()) {
+        throw std::invalid_argument("Cannot use " + name + " on non square matrix in node: " + node->toString());
+    }
+    Dimension dim = args[0].dimension();
+    if (name == "\\det") {
+        Value res(0.0, dim * (int) m.rows());
+        res.set_type(Value::INFERRED_DOUBLE);
+        return {res, std::move(local_vars)};
+    }
+    if (name == "\\inv") {
+        return {Value(Matrix(m.rows(), m.cols()), Dimension() - dim), std::move(local_vars)};
+    }
+    const Matrix &b = args[1].get_matrix();
+    if (b.rows() != m.rows()) {
+        throw std::invalid_argument("Matrix/vector dimensions mismatch in node: " + node->toString());
+    }
+    return {Value(Matrix(b.rows(), b.cols()), args[1].dimension() - dim), std::move(local_vars)};
+}
+
 auto global_idents = name_table();
 auto global_funcs = name_table();
 auto global_funcs_body = std::map<std::string, std::pair<Node*, std::vector<std::pair<std::string, Value>>>>();
 
+// \integral(f, a, b), \findroot(f, a, b), \odesolve(f, y0, a, b): границы - числа одной размерности.
+// Значение интеграла имеет размерность [f] [x], если результат f известен из анализа ее определения.
+// Траектория \odesolve - матрица со столбцами t, y_1, ..., y_n; число строк известно только при вычислении
+static std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse_numeric(
+    Node *node,
+    bool inside_func_or_block,
+    std::vector<std::pair<std::string, Value>> local_vars,
+    bool is_usub
+) {
+    const auto& name = node->get_label();
+    bool ode = name == "\\odesolve";
+    if (node->fields.size() != (ode ? 4 : 3)) {
+        throw std::invalid_argument("Wrong argument number in node: " + node->toString());
+    }
+    Node *func = node->fields[0];
+    if (func->get_tag() != Tag::IDENT || !func->fields.empty()) {
+        throw std::invalid_argument("Function name expected in " + name + " in node: " + node->toString());
+    }
+    size_t n = 1;   //размер состояния
+    if (ode) {
+        auto res = analyse(node->fields[1], inside_func_or_block, std::move(local_vars), is_usub);
+        local_vars = std::move(res.second);
+        if (res.first.type() == Value::MATRIX) {
+            n = res.first.get_matrix().size();
+        } else if (res.first.type() == Value::FUNCTION) {
+            throw std::invalid_argument("Initial state of " + name + " must be a number or a vector in node: " +
+                                        node->toString());
+        }
+    }
+    Value bound[2];
+    for (int i = 0; i < 2; ++i) {
+        auto res = analyse(node->fields[node->fields.size() - 2 + i], inside_func_or_block, std::move(local_vars), is_usub);
+        local_vars = std::move(res.second);
+        bound[i] = std::move(res.first);
+        if (bound[i].type() != Value::DOUBLE && bound[i].type() != Value::INFERRED_DOUBLE &&
+            bound[i].type() != Value::UNDEFINED) {
+            throw std::invalid_argument("Bounds of " + name + " must be numbers in node: " + node->toString());
+        }
+    }
+    bool known = bound[0].type() != Value::UNDEFINED && bound[1].type() != Value::UNDEFINED;
+    if (known && !Value::is_equal_dim(bound[0], bound[1])) {
+        throw std::invalid_argument("Bounds of " + name + " have different dimensions in node: " + node->toString());
+    }
+    if (ode) {
+        Value res(Matrix(1, n + 1), Value::dimensionless);
+        res.set_type(Value::INFERRED_MATRIX);
+        return {res, std::move(local_vars)};
+    }
+    Value res(0.0, known ? bound[0].dimension() : Value::dimensionless);
+    res.set_type(Value::INFERRED_DOUBLE);
+    if (name == "\\integral") {
+        auto f = global_funcs.find(func->get_label());
+        if (known && f != global_funcs.end() &&
+            (f->second.type() == Value::DOUBLE || f->second.type() == Value::INFERRED_DOUBLE)) {
+            res.set_dimension(Value::sum_dimensions(f->second.dimension(), bound[0].dimension()));
+        } else {
+            res.set_dimension(Value::dimensionless);
+        }
+    }
+    return {res, std::move(local_vars)};
+}
+
 std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     Node *node,
     bool inside_func_or_block,
@@ -201,7 +337,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
             val = -val;
         }
 
-        return {{val, Value::dimensionless}, local_vars};
+        return {{val, Value::dimensionless}, std::move(local_vars)};
     }
 
     if (current_tag == Tag::IDENT) {
@@ -218,9 +354,9 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (global_idents.count(ident_name) > 0) {
-            return {global_idents[ident_name], local_vars};
+            return {indexed(global_idents[ident_name], node), std::move(local_vars)};
         } else if (inside_func_or_block && founded) {
-            return {val, local_vars};
+            return {indexed(val, node), std::move(local_vars)};
         } else {
             throw std::invalid_argument("IDENT does not exists; node: " + node->toString());
         }
@@ -252,37 +388,37 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 const auto& expected = func_args[i].second;
 
                 if (!(
-                    expected._type == Value::UNDEFINED ||
+                    expected.type() == Value::UNDEFINED ||
                     (
-                        calculated._type == expected._type
+                        calculated.type() == expected.type()
                         ||
                         (
-                            (calculated._type == Value::DOUBLE || calculated._type == Value::INFERRED_DOUBLE) &&
-                            (expected._type == Value::DOUBLE || expected._type == Value::INFERRED_DOUBLE)
+                            (calculated.type() == Value::DOUBLE || calculated.type() == Value::INFERRED_DOUBLE) &&
+                            (expected.type() == Value::DOUBLE || expected.type() == Value::INFERRED_DOUBLE)
                         )
                         ||
                         (
-                            (calculated._type == Value::MATRIX || calculated._type == Value::INFERRED_MATRIX) &&
-                            (expected._type == Value::MATRIX || expected._type == Value::INFERRED_MATRIX)
+                            (calculated.type() == Value::MATRIX || calculated.type() == Value::INFERRED_MATRIX) &&
+                            (expected.type() == Value::MATRIX || expected.type() == Value::INFERRED_MATRIX)
                         )
                     ) && Value::is_equal_dim(calculated, expected)
                 )) {
                     throw std::invalid_argument(
                             "FUNC argument has an incorrect type (or different dimensions): " +
-                            Value::type_string(calculated._type) +
+                            Value::type_string(calculated.type()) +
                             " instead of: " +
-                            Value::type_string(expected._type) +
+                            Value::type_string(expected.type()) +
                             " in node: " +
                             node->toString()
                     );
                 }
             }
 
-            return {global_funcs.find(node->get_label())->second, local_vars};
+            return {global_funcs.find(node->get_label())->second, std::move(local_vars)};
         } else {
             for (const auto& local_var : local_vars) {
                 if (local_var.first == node->get_label()) {
-                    return {local_var.second, local_vars};
+                    return {local_var.second, std::move(local_vars)};
                 }
             }
         }
@@ -304,29 +440,29 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 auto right = analyse(
                     option->cond->right,
                     inside_func_or_block,
-                    left.second,
+                    std::move(left.second),
                     is_usub
                 );
 
                 if (
-                    left.first._type == Value::UNDEFINED &&
+                    left.first.type() == Value::UNDEFINED &&
                     option->cond->left->get_tag() == Tag::IDENT &&
-                    (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE)
+                    (right.first.type() == Value::DOUBLE || right.first.type() == Value::INFERRED_DOUBLE)
                 ) {
-                    left.first._type = Value::INFERRED_DOUBLE;
-                    left.first._dimension = right.first.get_dimension();
+                    left.first.set_type(Value::INFERRED_DOUBLE);
+                    left.first.set_dimension(right.first.get_dimension());
 
                     const std::string& ident_name = option->cond->left->get_label();
 
                     if (global_idents.count(ident_name) > 0) {
                         global_idents[ident_name] = Value(0.0, right.first.get_dimension());
-                        global_idents[ident_name]._type = Value::INFERRED_DOUBLE;
+                        global_idents[ident_name].set_type(Value::INFERRED_DOUBLE);
                     } else {
                         if (inside_func_or_block) {
                             for (auto& local_var : local_vars) {
                                 if (local_var.first == ident_name) {
                                     local_var.second = Value(0.0, right.first.get_dimension());
-                                    local_var.second._type = Value::INFERRED_DOUBLE;
+                                    local_var.second.set_type(Value::INFERRED_DOUBLE);
                                 }
                             }
                         }
@@ -334,24 +470,24 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 }
 
                 if (
-                    right.first._type == Value::UNDEFINED &&
+                    right.first.type() == Value::UNDEFINED &&
                     option->cond->right->get_tag() == Tag::IDENT &&
-                    (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE)
+                    (left.first.type() == Value::DOUBLE || left.first.type() == Value::INFERRED_DOUBLE)
                 ) {
-                    right.first._type = Value::INFERRED_DOUBLE;
-                    right.first._dimension = left.first.get_dimension();
+                    right.first.set_type(Value::INFERRED_DOUBLE);
+                    right.first.set_dimension(left.first.get_dimension());
 
                     const std::string& ident_name = option->cond->right->get_label();
 
                     if (global_idents.count(ident_name) > 0) {
                         global_idents[ident_name] = Value(0.0, left.first.get_dimension());
-                        global_idents[ident_name]._type = Value::INFERRED_DOUBLE;
+                        global_idents[ident_name].set_type(Value::INFERRED_DOUBLE);
                     } else {
                         if (inside_func_or_block) {
                             for (auto& local_var : local_vars) {
                                 if (local_var.first == ident_name) {
                                     local_var.second = Value(0.0, left.first.get_dimension());
-                                    local_var.second._type = Value::INFERRED_DOUBLE;
+                                    local_var.second.set_type(Value::INFERRED_DOUBLE);
                                 }
                             }
                         }
@@ -359,11 +495,11 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 }
 
                 if (!(
-                    left.first._type == right.first._type &&
-                    left.first._type == Value::DOUBLE &&
+                    left.first.type() == right.first.type() &&
+                    left.first.type() == Value::DOUBLE &&
                     Value::check_dimensions(left.first.get_dimension(), right.first.get_dimension())
                 )) {
-                    if (left.first._type == Value::UNDEFINED) {
+                    if (left.first.type() == Value::UNDEFINED) {
                         throw std::invalid_argument(
                                 "Undefined value: " +
                                 to_string(left.first) +
@@ -372,7 +508,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         );
                     }
 
-                    if (right.first._type == Value::UNDEFINED) {
+                    if (right.first.type() == Value::UNDEFINED) {
                         throw std::invalid_argument(
                                 "Undefined value: " +
                                 to_string(right.first) +
@@ -381,7 +517,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         );
                     }
 
-                    if (left.first._type == Value::INFERRED_DOUBLE) {
+                    if (left.first.type() == Value::INFERRED_DOUBLE) {
                         throw std::invalid_argument(
                                 "Cannot compare using inferred double value: " +
                                 to_string(left.first) +
@@ -390,7 +526,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         );
                     }
 
-                    if (right.first._type == Value::INFERRED_DOUBLE) {
+                    if (right.first.type() == Value::INFERRED_DOUBLE) {
                         throw std::invalid_argument(
                                 "Cannot compare using inferred double value: " +
                                 to_string(right.first) +
@@ -412,37 +548,37 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 switch (cond_tag) {
                     case Tag::GT:
                         if (left.first.get_double() > right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option->right, inside_func_or_block, std::move(right.second), is_usub);
                         } else {
                             continue;
                         }
                     case Tag::GEQ:
                         if (left.first.get_double() >= right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option->right, inside_func_or_block, std::move(right.second), is_usub);
                         } else {
                             continue;
                         }
                     case Tag::LT:
                         if (left.first.get_double() < right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option->right, inside_func_or_block, std::move(right.second), is_usub);
                         } else {
                             continue;
                         }
                     case Tag::LEQ:
                         if (left.first.get_double() <= right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option->right, inside_func_or_block, std::move(right.second), is_usub);
                         } else {
                             continue;
                         }
                     case Tag::EQ:
                         if (left.first.get_double() == right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option->right, inside_func_or_block, std::move(right.second), is_usub);
                         } else {
                             continue;
                         }
                     case Tag::NEQ:
                         if (left.first.get_double() != right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option->right, inside_func_or_block, std::move(right.second), is_usub);
                         } else {
                             continue;
                         }
@@ -459,17 +595,17 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         );
                 }
             } else {
-                return analyse(option->right, inside_func_or_block, local_vars, is_usub);
+                return analyse(option->right, inside_func_or_block, std::move(local_vars), is_usub);
             }
         }
     }
 
     if (current_tag == Tag::UADD || current_tag == Tag::NOT || current_tag == Tag::LPAREN) {
-        return analyse(node->right, inside_func_or_block, local_vars, is_usub);
+        return analyse(node->right, inside_func_or_block, std::move(local_vars), is_usub);
     }
 
     if (current_tag == Tag::USUB) {
-        return analyse(node->right, inside_func_or_block, local_vars, true);
+        return analyse(node->right, inside_func_or_block, std::move(local_vars), true);
     }
 
     if (
@@ -485,26 +621,26 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         current_tag == Tag::NEQ
     ) {
         auto left = analyse(node->left, inside_func_or_block, local_vars, is_usub);
-        auto right = analyse(node->right, inside_func_or_block, left.second, is_usub);
+        auto right = analyse(node->right, inside_func_or_block, std::move(left.second), is_usub);
 
         if (
-            left.first._type == Value::UNDEFINED &&
+            left.first.type() == Value::UNDEFINED &&
             node->left->get_tag() == Tag::IDENT &&
-            (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE)
+            (right.first.type() == Value::DOUBLE || right.first.type() == Value::INFERRED_DOUBLE)
         ) {
-            left.first._type = Value::INFERRED_DOUBLE;
-            left.first._dimension = right.first.get_dimension();
+            left.first.set_type(Value::INFERRED_DOUBLE);
+            left.first.set_dimension(right.first.get_dimension());
             const std::string& ident_name = node->left->get_label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(0.0, right.first.get_dimension());
-                global_idents[ident_name]._type = Value::INFERRED_DOUBLE;
+                global_idents[ident_name].set_type(Value::INFERRED_DOUBLE);
             } else {
                 if (inside_func_or_block) {
                     for (int i = 0; i < local_vars.size(); i++) {
                         if (local_vars[i].first == ident_name) {
                             local_vars[i].second = Value(0.0, right.first.get_dimension());
-                            local_vars[i].second._type = Value::INFERRED_DOUBLE;
+                            local_vars[i].second.set_type(Value::INFERRED_DOUBLE);
                         }
                     }
                 }
@@ -512,12 +648,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (
-            left.first._type == Value::UNDEFINED &&
+            left.first.type() == Value::UNDEFINED &&
             node->left->get_tag() == Tag::IDENT &&
-            (right.first._type == Value::MATRIX || right.first._type == Value::INFERRED_MATRIX)
+            (right.first.type() == Value::MATRIX || right.first.type() == Value::INFERRED_MATRIX)
         ) {
-            left.first._type = Value::INFERRED_MATRIX;
-            left.first._dimension = right.first.get_dimension();
+            left.first.set_type(Value::INFERRED_MATRIX);
+            left.first.set_dimension(right.first.get_dimension());
             const std::string& ident_name = node->left->get_label();
 
             if (global_idents.count(ident_name) > 0) {
@@ -534,23 +670,23 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (
-            right.first._type == Value::UNDEFINED &&
+            right.first.type() == Value::UNDEFINED &&
             node->right->get_tag() == Tag::IDENT &&
-            (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE)
+            (left.first.type() == Value::DOUBLE || left.first.type() == Value::INFERRED_DOUBLE)
         ) {
-            right.first._type = Value::INFERRED_DOUBLE;
-            right.first._dimension = left.first.get_dimension();
+            right.first.set_type(Value::INFERRED_DOUBLE);
+            right.first.set_dimension(left.first.get_dimension());
             const std::string& ident_name = node->right->get_label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(0.0, left.first.get_dimension());
-                global_idents[ident_name]._type = Value::INFERRED_DOUBLE;
+                global_idents[ident_name].set_type(Value::INFERRED_DOUBLE);
             } else {
                 if (inside_func_or_block) {
                     for (int i = 0; i < local_vars.size(); i++) {
                         if (local_vars[i].first == ident_name) {
                             local_vars[i].second = Value(0.0, left.first.get_dimension());
-                            local_vars[i].second._type = Value::INFERRED_DOUBLE;
+                            local_vars[i].second.set_type(Value::INFERRED_DOUBLE);
                         }
                     }
                 }
@@ -558,12 +694,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (
-            right.first._type == Value::UNDEFINED &&
+            right.first.type() == Value::UNDEFINED &&
             node->left->get_tag() == Tag::IDENT &&
-            (left.first._type == Value::MATRIX || left.first._type == Value::INFERRED_MATRIX)
+            (left.first.type() == Value::MATRIX || left.first.type() == Value::INFERRED_MATRIX)
         ) {
-            right.first._type = Value::INFERRED_MATRIX;
-            right.first._dimension = left.first.get_dimension();
+            right.first.set_type(Value::INFERRED_MATRIX);
+            right.first.set_dimension(left.first.get_dimension());
             const std::string& ident_name = node->left->get_label();
 
             if (global_idents.count(ident_name) > 0) {
@@ -580,16 +716,16 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (!(
-            (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE) &&
-            (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE) &&
+            (left.first.type() == Value::DOUBLE || left.first.type() == Value::INFERRED_DOUBLE) &&
+            (right.first.type() == Value::DOUBLE || right.first.type() == Value::INFERRED_DOUBLE) &&
             Value::check_dimensions(left.first.get_dimension(), right.first.get_dimension())
             ||
-            (left.first._type == Value::MATRIX || left.first._type == Value::INFERRED_MATRIX) &&
-            (right.first._type == Value::MATRIX || right.first._type == Value::INFERRED_MATRIX) &&
+            (left.first.type() == Value::MATRIX || left.first.type() == Value::INFERRED_MATRIX) &&
+            (right.first.type() == Value::MATRIX || right.first.type() == Value::INFERRED_MATRIX) &&
             Value::is_matrix_equals_dims(left.first.get_matrix(), right.first.get_matrix()) &&
             (current_tag == Tag::ADD || current_tag == Tag::SUB)
         )) {
-            if (left.first._type == Value::UNDEFINED) {
+            if (left.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(left.first) +
@@ -598,7 +734,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 );
             }
 
-            if (right.first._type == Value::UNDEFINED) {
+            if (right.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(right.first) +
@@ -617,30 +753,30 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
             );
         }
 
-        return {right.first, local_vars};
+        return {right.first, std::move(local_vars)};
     }
 
     if (current_tag == Tag::MUL || current_tag == Tag::DIV || current_tag == Tag::FRAC) {
         auto left = analyse(node->left, inside_func_or_block, local_vars, is_usub);
-        auto right = analyse(node->right, inside_func_or_block, left.second, is_usub);
+        auto right = analyse(node->right, inside_func_or_block, std::move(left.second), is_usub);
 
         if (
-            left.first._type == Value::UNDEFINED &&
+            left.first.type() == Value::UNDEFINED &&
             node->left->get_tag() == Tag::IDENT &&
-            (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE)
+            (right.first.type() == Value::DOUBLE || right.first.type() == Value::INFERRED_DOUBLE)
         ) {
-            left.first._type = Value::INFERRED_DOUBLE;
+            left.first.set_type(Value::INFERRED_DOUBLE);
             const std::string& ident_name = node->left->get_label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(0.0);
-                global_idents[ident_name]._type = Value::INFERRED_DOUBLE;
+                global_idents[ident_name].set_type(Value::INFERRED_DOUBLE);
             } else {
                 if (inside_func_or_block) {
                     for (auto& local_var : local_vars) {
                         if (local_var.first == ident_name) {
                             local_var.second = Value(0.0);
-                            local_var.second._type = Value::INFERRED_DOUBLE;
+                            local_var.second.set_type(Value::INFERRED_DOUBLE);
                         }
                     }
                 }
@@ -648,12 +784,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (
-            left.first._type == Value::UNDEFINED &&
+            left.first.type() == Value::UNDEFINED &&
             node->left->get_tag() == Tag::IDENT &&
-            (right.first._type == Value::MATRIX || right.first._type == Value::INFERRED_MATRIX)
+            (right.first.type() == Value::MATRIX || right.first.type() == Value::INFERRED_MATRIX)
         ) {
-            left.first._type = Value::INFERRED_MATRIX;
-            left.first._dimension = right.first.get_dimension();
+            left.first.set_type(Value::INFERRED_MATRIX);
+            left.first.set_dimension(right.first.get_dimension());
             const std::string& ident_name = node->left->get_label();
 
             if (global_idents.count(ident_name) > 0) {
@@ -670,22 +806,22 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (
-            right.first._type == Value::UNDEFINED &&
+            right.first.type() == Value::UNDEFINED &&
             node->right->get_tag() == Tag::IDENT &&
-            (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE)
+            (left.first.type() == Value::DOUBLE || left.first.type() == Value::INFERRED_DOUBLE)
         ) {
-            right.first._type = Value::INFERRED_DOUBLE;
+            right.first.set_type(Value::INFERRED_DOUBLE);
             const std::string& ident_name = node->right->get_label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(0.0);
-                global_idents[ident_name]._type = Value::INFERRED_DOUBLE;
+                global_idents[ident_name].set_type(Value::INFERRED_DOUBLE);
             } else {
                 if (inside_func_or_block) {
                     for (auto& local_var : local_vars) {
                         if (local_var.first == ident_name) {
                             local_var.second = Value(0.0);
-                            local_var.second._type = Value::INFERRED_DOUBLE;
+                            local_var.second.set_type(Value::INFERRED_DOUBLE);
                         }
                     }
                 }
@@ -693,12 +829,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (
-            right.first._type == Value::UNDEFINED &&
+            right.first.type() == Value::UNDEFINED &&
             node->left->get_tag() == Tag::IDENT &&
-            (left.first._type == Value::MATRIX || left.first._type == Value::INFERRED_MATRIX)
+            (left.first.type() == Value::MATRIX || left.first.type() == Value::INFERRED_MATRIX)
         ) {
-            right.first._type = Value::INFERRED_MATRIX;
-            right.first._dimension = left.first.get_dimension();
+            right.first.set_type(Value::INFERRED_MATRIX);
+            right.first.set_dimension(left.first.get_dimension());
             const std::string& ident_name = node->left->get_label();
 
             if (global_idents.count(ident_name) > 0) {
@@ -715,15 +851,15 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (!(
-            (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE) &&
-            (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE)
+            (left.first.type() == Value::DOUBLE || left.first.type() == Value::INFERRED_DOUBLE) &&
+            (right.first.type() == Value::DOUBLE || right.first.type() == Value::INFERRED_DOUBLE)
             ||
             current_tag == Tag::MUL &&
-            (left.first._type == Value::MATRIX || left.first._type == Value::INFERRED_MATRIX) &&
-            (right.first._type == Value::MATRIX || right.first._type == Value::INFERRED_MATRIX) &&
-            (left.first.get_matrix()[0].size() == right.first.get_matrix().size())
+            (left.first.type() == Value::MATRIX || left.first.type() == Value::INFERRED_MATRIX) &&
+            (right.first.type() == Value::MATRIX || right.first.type() == Value::INFERRED_MATRIX) &&
+            (left.first.get_matrix().cols() == right.first.get_matrix().rows())
         )) {
-            if (left.first._type == Value::UNDEFINED) {
+            if (left.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(left.first) +
@@ -732,7 +868,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 );
             }
 
-            if (right.first._type == Value::UNDEFINED) {
+            if (right.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(right.first) +
@@ -752,40 +888,40 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (current_tag == Tag::MUL) {
-            if (left.first._type == Value::MATRIX || left.first._type == Value::INFERRED_MATRIX) {
+            if (left.first.type() == Value::MATRIX || left.first.type() == Value::INFERRED_MATRIX) {
                 return {
                     {
-                        left.first.get_matrix(),
+                        Matrix(left.first.get_matrix().rows(), right.first.get_matrix().cols()),
                         Value::sum_dimensions(left.first.get_dimension(), right.first.get_dimension())
                     },
-                    right.second
+                    std::move(right.second)
                 };
             } else {
                 return {
                     {Value::sum_dimensions(left.first.get_dimension(), right.first.get_dimension())},
-                    right.second
+                    std::move(right.second)
                 };
             }
         } else {
             return {
                 {Value::sub_dimensions(left.first.get_dimension(), right.first.get_dimension())},
-                right.second
+                std::move(right.second)
             };
         }
     }
 
     if (current_tag == Tag::POW) {
         auto left = analyse(node->left, inside_func_or_block, local_vars, is_usub);
-        auto right = analyse(node->right, inside_func_or_block, left.second, is_usub);
+        auto right = analyse(node->right, inside_func_or_block, std::move(left.second), is_usub);
 
         if (!(
-            (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE) &&
-            (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE) &&
+            (left.first.type() == Value::DOUBLE || left.first.type() == Value::INFERRED_DOUBLE) &&
+            (right.first.type() == Value::DOUBLE || right.first.type() == Value::INFERRED_DOUBLE) &&
             Value::is_dimensionless(right.first) &&
             right.first.get_double() == trunc(right.first.get_double()) &&
             right.first.get_double() >= 1
         )) {
-            if (left.first._type == Value::UNDEFINED) {
+            if (left.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(left.first) +
@@ -794,7 +930,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 );
             }
 
-            if (right.first._type == Value::UNDEFINED) {
+            if (right.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(right.first) +
@@ -815,22 +951,22 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
         return {
             {Value::mul_dimensions(left.first.get_dimension(), (int) right.first.get_double())},
-            right.second
+            std::move(right.second)
         };
     }
 
     if (current_tag == Tag::SUM || current_tag == Tag::PRODUCT) {
         auto left = analyse(node->left, inside_func_or_block, local_vars, is_usub);
-        auto cond = analyse(node->cond, inside_func_or_block, left.second, is_usub);
-        auto right = analyse(node->right, inside_func_or_block, cond.second, is_usub);
+        auto cond = analyse(node->cond, inside_func_or_block, std::move(left.second), is_usub);
+        auto right = analyse(node->right, inside_func_or_block, std::move(cond.second), is_usub);
 
         if (!(
-            (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE) &&
-            (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE) &&
+            (left.first.type() == Value::DOUBLE || left.first.type() == Value::INFERRED_DOUBLE) &&
+            (right.first.type() == Value::DOUBLE || right.first.type() == Value::INFERRED_DOUBLE) &&
             Value::is_dimensionless(left.first) &&
             Value::is_dimensionless(cond.first)
         )) {
-            if (left.first._type == Value::UNDEFINED) {
+            if (left.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(left.first) +
@@ -839,7 +975,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                 );
             }
 
-            if (right.first._type == Value::UNDEFINED) {
+            if (right.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(right.first) +
@@ -859,14 +995,14 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (current_tag == Tag::SUM) {
-            return analyse(node->right, inside_func_or_block, local_vars, is_usub);
+            return analyse(node->right, inside_func_or_block, std::move(local_vars), is_usub);
         } else {
             return {
                 Value::mul_dimensions(
                     right.first.get_dimension(),
                     floor(cond.first.get_double() - left.first.get_double())
                 ),
-                right.second
+                std::move(right.second)
             };
         }
     }
@@ -881,8 +1017,8 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     if (current_tag == Tag::ABS) {
         auto right = analyse(node->right, inside_func_or_block, local_vars, is_usub);
 
-        if (right.first._type != Value::DOUBLE && right.first._type != Value::INFERRED_DOUBLE) {
-            if (right.first._type == Value::UNDEFINED) {
+        if (right.first.type() != Value::DOUBLE && right.first.type() != Value::INFERRED_DOUBLE) {
+            if (right.first.type() == Value::UNDEFINED) {
                 throw std::invalid_argument(
                         "Undefined value: " +
                         to_string(right.first) +
@@ -904,9 +1040,9 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
     if (current_tag == Tag::EQ) {
         if (node->right->get_tag() != Tag::PLACEHOLDER) {
-            return analyse(node->right, inside_func_or_block, local_vars, is_usub);
+            return analyse(node->right, inside_func_or_block, std::move(local_vars), is_usub);
         } else {
-            return analyse(node->left, inside_func_or_block, local_vars, is_usub);
+            return analyse(node->left, inside_func_or_block, std::move(local_vars), is_usub);
         }
     }
 
@@ -939,13 +1075,13 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
             for (int i = 0; i < local_vars.size(); i++) {
                 if (local_vars[i].first == ident_name) {
                     local_vars[i].second = res.first;
-                    return {res.first, local_vars};
+                    return {res.first, std::move(local_vars)};
                 }
             }
 
             local_vars.emplace_back(ident_name, res.first);
 
-            return {res.first, local_vars};
+            return {res.first, std::move(local_vars)};
         } else {
             if (node->left->get_tag() == Tag::IDENT) {
                 const std::string& ident_name = node->left->get_label();
@@ -994,6 +1130,17 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                     res.emplace_back(field->get_label(), Value());
                 }
 
+                // имя функции в ее теле обозначает ее саму: на время анализа тела рекурсивный вызов
+                // проверяется по числу аргументов, а его результат неизвестен
+                const auto& func_name = node->left->get_label();
+                auto old_func = global_funcs.find(func_name);
+                bool redefined = old_func != global_funcs.end();
+                Value old_result = redefined ? old_func->second : Value();
+                auto old_body = redefined ? global_funcs_body.find(func_name)->second
+                                          : std::pair<Node*, std::vector<std::pair<std::string, Value>>>();
+                global_funcs[func_name] = Value();
+                global_funcs_body[func_name] = {node->right, res};
+
                 const auto& to_return = analyse(
                     node->right,
                     true,
@@ -1001,18 +1148,19 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                     is_usub
                 );
 
-                global_funcs.emplace(node->left->get_label(), to_return.first);
-
-                global_funcs_body.emplace(
-                        node->left->get_label(),
-                        std::pair<Node*, std::vector<std::pair<std::string, Value>>>(
+                if (redefined) {
+                    global_funcs[func_name] = old_result;
+                    global_funcs_body[func_name] = old_body;
+                } else {
+                    global_funcs[func_name] = to_return.first;
+                    global_funcs_body[func_name] = std::pair<Node*, std::vector<std::pair<std::string, Value>>>(
                             node->right,
                             std::vector<std::pair<std::string, Value>>(
                                     to_return.second.begin(),
                                     to_return.second.begin() + (long) res.size()
                             )
-                        )
-                );
+                    );
+                }
 
                 return to_return;
             } else {
@@ -1024,7 +1172,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     if (current_tag == Tag::BEGINB) {
         for (int i = 0; i < node->fields.size(); ++i) {
             if (i == node->fields.size() - 1) {
-                return analyse(node->fields[i], true, local_vars, is_usub);
+                return analyse(node->fields[i], true, std::move(local_vars), is_usub);
             } else {
                 const auto& res = analyse(
                     node->fields[i],
@@ -1038,26 +1186,27 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     }
 
     if (current_tag == Tag::BEGINM) {
-        Matrix m;
         Value x;
 
         if (!node->fields.empty() && !node->fields[0]->fields.empty()) {
             x = analyse(node->fields[0]->fields[0], inside_func_or_block, local_vars, is_usub).first;
         }
 
-        for (const auto& field : node->fields) {
-            std::vector<Value> v;
-            for (const auto& jt : field->fields) {
-                v.push_back(x);
-            }
-            m.push_back(v);
-        }
-        return {Value(m), local_vars};
+        size_t cols = node->fields.empty() ? 0 : node->fields[0]->fields.size();
+        return {Value(Matrix(node->fields.size(), cols), x.dimension()), std::move(local_vars)};
     }
 
     if (current_tag == Tag::WHILE) {
         analyse(node->cond, inside_func_or_block, local_vars, is_usub);
-        return analyse(node->right, inside_func_or_block, local_vars, is_usub);
+        return analyse(node->right, inside_func_or_block, std::move(local_vars), is_usub);
+    }
+
+    if (current_tag == Tag::KEYWORD && funcs_matrix.count(node->get_label()) > 0) {
+        return analyse_linear(node, inside_func_or_block, std::move(local_vars), is_usub);
+    }
+
+    if (current_tag == Tag::KEYWORD && funcs_numeric.count(node->get_label()) > 0) {
+        return analyse_numeric(node, inside_func_or_block, std::move(local_vars), is_usub);
     }
 
     if (
@@ -1067,9 +1216,9 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         current_tag == Tag::FLOOR
     ) {
         auto to_return = Value();
-        to_return._type = Value::INFERRED_DOUBLE;
+        to_return.set_type(Value::INFERRED_DOUBLE);
 
-        return {to_return, local_vars};
+        return {to_return, std::move(local_vars)};
     }
 
     if (
@@ -1077,20 +1226,20 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         current_tag == Tag::RANGE ||
         current_tag == Tag::LIST
     ) {
-        return {Value(), local_vars};
+        return {Value(), std::move(local_vars)};
     }
 
     if (current_tag == Tag::IF) {
-        const auto& res = analyse(node->cond, inside_func_or_block, local_vars, is_usub);
-        return analyse(node->right, inside_func_or_block, res.second, is_usub);
+        auto res = analyse(node->cond, inside_func_or_block, std::move(local_vars), is_usub);
+        return analyse(node->right, inside_func_or_block, std::move(res.second), is_usub);
     }
 
     if (current_tag == Tag::TRANSP) {
-        const auto& res = analyse(node->left, inside_func_or_block, local_vars, is_usub);
+        auto res = analyse(node->left, inside_func_or_block, std::move(local_vars), is_usub);
 
         return {
             Value::transpose(res.first),
-            res.second
+            std::move(res.second)
         };
     }
 
@@ -6,7 +6,13 @@
 #include "Lexer.h"
 #include "Node.h"
 #include "Value.h"
+#include "CallFrame.h"
+#include "ThreadPool.h"
+#include "Plot.h"
 #include <ctime>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <chrono>
 
 
@@ -15,24 +21,79 @@ name_table Node::global;
 replacement_map Node::reps;
 
 
+//режим --plot-data: файлы с точками называются по входному файлу и лежат рядом с ним
+static std::string data_dir;
+static std::string data_stem;
+static size_t data_count = 0;
+static std::vector<std::string> data_written;
+
+static void append_table(std::string &res, const Coordinate &pos, const Value &points) {
+	std::string name = data_stem + "-graphic" + std::to_string(++data_count) + ".dat";
+	if (!Plot::write_table(data_dir + name, points.get_matrix())) {
+		throw Error(pos, "Couldn't write plot data file " + data_dir + name);
+	}
+	data_written.push_back(data_dir + name);
+	res += "\\plotfile{" + name + "}";
+}
+
+//значение ключа вида --name N: положительное целое. Иначе (и если значения нет) сообщение об ошибке и false
+static bool positive_option(const char *name, const char *arg, size_t &res) {
+	if (!arg) {
+		std::cerr << name << ": missing value" << std::endl;
+		return false;
+	}
+	char *end;
+	errno = 0;
+	unsigned long v = std::strtoul(arg, &end, 10);
+	if (end == arg || *end || errno || v == 0 || arg[0] == '-') {
+		std::cerr << name << ": expected a positive integer, got \"" << arg << "\"" << std::endl;
+		return false;
+	}
+	res = v;
+	return true;
+}
+
+//значение ключа вида --name X: неотрицательное конечное число
+static bool nonnegative_option(const char *name, const char *arg, double &res) {
+	if (!arg) {
+		std::cerr << name << ": missing value" << std::endl;
+		return false;
+	}
+	char *end;
+	errno = 0;
+	double v = std::strtod(arg, &end);
+	if (end == arg || *end || errno || !std::isfinite(v) || v < 0) {
+		std::cerr << name << ": expected a non-negative number, got \"" << arg << "\"" << std::endl;
+		return false;
+	}
+	res = v;
+	return true;
+}
+
 std::string make_replacement(const std::string& prog, const replacement_map& m) {
 	std::string res;
 	size_t index = 0;
 
 //	std::cout << "make_replacement.size = " << m.size() << std::endl;
 
+	res.reserve(prog.size());
 	for (auto& it : m) {
-		res += prog.substr(index, it.second.begin - index);
-		if (it.second.tag == GRAPHIC) {
-			res += "{" + to_plot(it.second.replacement) + "}";
+		res.append(prog, index, it.second.begin - index);
+		res += '{';
+		if (it.second.tag == GRAPHIC && Plot::data_files) {
+			append_table(res, it.first, it.second.replacement);
+		}
+		else if (it.second.tag == GRAPHIC) {
+			append_plot(res, it.second.replacement);    //точки пишутся прямо в результат
 		}
 		else {
 //		    std::cout << "second.replacement = " << to_string((*it).second.replacement) << std::endl;
-			res += "{" + to_string(it.second.replacement) + "}";
+			res += to_string(it.second.replacement);
 		}
+		res += '}';
 		index = it.second.end;
 	}
-	res += prog.substr(index);
+	res.append(prog, index, std::string::npos);
 	return res;
 }
 
@@ -47,6 +108,62 @@ int main(int argc, char *argv[]) {
 	const char *file_in;
 	const char *file_out;
 
+	//ключи вида --name value, остальные аргументы - имена файлов
+	std::vector<char *> files;
+	for (int i = 1; i < argc; ++i) {
+		const char *opt = argv[i];
+		const char *arg = (i + 1 < argc) ? argv[i + 1] : nullptr;  //значение, если ключ его принимает
+		if (!std::strcmp(opt, "--max-depth")) {
+			if (!positive_option(opt, arg, CallStack::max_depth)) return 1;
+			++i;
+		}
+		else if (!std::strcmp(opt, "--threads")) {
+			//потоки для точек \graphic и для умножения больших матриц
+			if (!positive_option(opt, arg, ThreadPool::threads)) return 1;
+			++i;
+		}
+		else if (!std::strcmp(opt, "--plot-precision")) {
+			size_t precision;
+			if (!positive_option(opt, arg, precision)) return 1;
+			Plot::precision = (int) std::min(precision, (size_t) max_fixed_precision);
+			++i;
+		}
+		else if (!std::strcmp(opt, "--plot-simplify")) {
+			if (!nonnegative_option(opt, arg, Plot::simplify)) return 1;
+			++i;
+		}
+		else if (!std::strcmp(opt, "--plot-data")) {
+			Plot::data_files = true;
+		}
+		else if (!std::strcmp(opt, "--memo-limit")) {
+			if (!positive_option(opt, arg, Memo::limit)) return 1;
+			++i;
+		}
+		else if (!std::strcmp(opt, "--memo-stats")) {
+			Memo::stats = true;
+		}
+		else if (!std::strcmp(opt, "--adaptive")) {
+			Plot::adaptive = true;
+		}
+		else if (!std::strcmp(opt, "--plot-tolerance")) {
+			if (!nonnegative_option(opt, arg, Plot::tolerance)) return 1;
+			++i;
+		}
+		else if (!std::strcmp(opt, "--plot-min-points")) {
+			if (!positive_option(opt, arg, Plot::min_points)) return 1;
+			++i;
+		}
+		else if (!std::strcmp(opt, "--plot-max-points")) {
+			if (!positive_option(opt, arg, Plot::max_points)) return 1;
+			++i;
+		}
+		else {
+			files.push_back(argv[i]);
+		}
+	}
+	argc = (int) files.size() + 1;
+	std::copy(files.begin(), files.end(), argv + 1);
+
 	if (argc < 2 || argc > 3) { //число аргументов должно быть равно 1 или 2
 		file_in = "test.tex";
 		file_out = "_test.tex";
@@ -69,13 +186,24 @@ int main(int argc, char *argv[]) {
 //	std::cout << file_in;
 //	std::cout << file_out;
 
+	{
+		std::string in(file_in);
+		size_t slash = in.find_last_of('/');
+		data_dir = (slash == std::string::npos) ? "" : in.substr(0, slash + 1);
+		data_stem = in.substr(data_dir.size());
+		size_t dot = data_stem.find_last_of('.');
+		if (dot != std::string::npos && dot > 0) {
+			data_stem.erase(dot);
+		}
+	}
+
 	FileHandler &fh = FileHandler::Instance(file_in, file_out);
 	if (!fh.good()) {
 		std::cerr << file_in << ":" << "Failed to initialize" << std::endl;
 		ok = false;
 	}
 
-	Node *res;
+	std::shared_ptr<Node> res;
 	while (ok) {
 		Position::ps = fh.next();
         if (Position::ps.program.empty()) {
@@ -89,7 +217,7 @@ int main(int argc, char *argv[]) {
 //            }
 			B.init(p);
 //            std::cout << "after B.init(p);\n";
-			res = new Node();
+			res = std::make_shared<Node>();
 //            std::cout << "after res = new Node();\n";
 			res->fields = B.block(NONE);
 //            std::cout << "after B.block(NONE);\n";
@@ -100,6 +228,9 @@ int main(int argc, char *argv[]) {
             // Стадия семантического анализа для проверки корректности операций с размерными физическими величинами
             res->semantic_analysis();
 
+            // вынос инвариантов циклов и прочие преобразования дерева
+            res->optimize();
+
 			res->exec({});
 //			std::cout << "after exec()\n";
 
@@ -126,21 +257,29 @@ int main(int argc, char *argv[]) {
 			ok = false;
 		}
 
-        delete res;
+        //тела объявленных функций переживут дерево блока: у них свой счетчик ссылок
+        res.reset();
 	}
 
 	if (ok) {                   //если удалось обработать файл и
 		if (replace) {          //если надо перезаписать файл
 			fh.replace_files();
 		}
-	} else { //если не удалось обработать файл, то удалить выходной файл
+	} else { //если не удалось обработать файл, то удалить выходной файл и файлы с точками
 		fh.remove_out();
+		for (auto &name : data_written) {
+			std::remove(name.c_str());
+		}
 	}
 
 //	if (replace) {
 //	    delete[] file_out;
 //	}
 
+    if (Memo::stats) {
+        std::cerr << "memo: " << Memo::hits.load() << " hits, " << Memo::misses.load() << " misses" << std::endl;
+    }
+
     auto end = std::chrono::steady_clock::now();
     auto diff = end - start;
     std::cout << std::chrono::duration <double, std::milli> (diff).count() << std::endl;